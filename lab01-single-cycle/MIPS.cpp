@@ -3,9 +3,13 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <optional>
 #include <string>
 #include <vector>
 
+#include "../lab03-cache-simulator/access_stream.h"
+#include "../lab04-page-table/vm.h"
+
 #ifdef DEBUG
 #include "../debug.h"
 #else
@@ -189,7 +193,8 @@ class INSMem {
    public:
     bitset< 32 > Instruction;
 
-    INSMem() {
+    // mmu: translates fetch addresses, nullptr for physical addressing
+    explicit INSMem(vm::Mmu* mmu_ = nullptr) : mmu(mmu_) {
         IMem.resize(MemSize);
         ifstream imem;
         string line;
@@ -214,6 +219,9 @@ class INSMem {
          * and return the read result.
          */
         unsigned address = ReadAddress.to_ulong();
+        if (mmu) {
+            address = mmu->translate(address, vm::access::fetch);
+        }
         Instruction = IMem[address + 0].to_ulong() << 24 |
                       IMem[address + 1].to_ulong() << 16 |
                       IMem[address + 2].to_ulong() << 8 |
@@ -230,12 +238,15 @@ class INSMem {
 
    private:
     vector< bitset< 8 > > IMem;
+    vm::Mmu* mmu;
 };
 
 class DataMem {
    public:
     bitset< 32 > readdata;
-    DataMem() {
+    // mmu: translates load and store addresses, nullptr for physical
+    // addressing
+    explicit DataMem(vm::Mmu* mmu_ = nullptr) : mmu(mmu_) {
         DMem.resize(MemSize);
         ifstream dmem;
         string line;
@@ -249,6 +260,19 @@ class DataMem {
         } else
             cout << "Unable to open file";
         dmem.close();
+
+        // MEMTRACE=<file or fifo> streams every load and store to the cache
+        // simulator, MEMTRACE_FORMAT=binary for the binary access format
+        if (const char* path = std::getenv("MEMTRACE")) {
+            const char* format = std::getenv("MEMTRACE_FORMAT");
+            const bool binary =
+                format != nullptr && string(format) == "binary";
+            memtrace_file.open(path, binary ? ios::binary : ios::out);
+            if (memtrace_file.is_open()) {
+                memtrace.emplace(memtrace_file, binary);
+            } else
+                cout << "Unable to open file";
+        }
     }
     bitset< 32 > MemoryAccess(bitset< 32 > Address, bitset< 32 > WriteData,
                               bitset< 1 > readmem, bitset< 1 > writemem) {
@@ -266,6 +290,14 @@ class DataMem {
             throw logic_error("data mem op conflict");
         }
         unsigned address = Address.to_ulong();
+        if (mmu && (readmem == 1 || writemem == 1)) {
+            address = mmu->translate(address, readmem == 1
+                                                  ? vm::access::load
+                                                  : vm::access::store);
+        }
+        if (memtrace && (readmem == 1 || writemem == 1)) {
+            memtrace->record(readmem == 1 ? 'R' : 'W', address);
+        }
 
         if (readmem == 1) {
             readdata = B32(DMem[address + 0].to_ulong() << 24 |
@@ -311,18 +343,27 @@ class DataMem {
 
    private:
     vector< bitset< 8 > > DMem;
+    ofstream memtrace_file;
+    std::optional< access_stream::Writer > memtrace;
+    vm::Mmu* mmu;
 };
 
 int main() {
     oldCoutState.copyfmt(std::cout);
 
+    // PTBR=<file> runs the program in a virtual address space (vm.h)
+    std::optional< vm::Mmu > mmu;
+    if (const auto config = vm::Config::from_env()) {
+        mmu.emplace(*config, MemSize);
+    }
+
     RF myRF;
     ALU myALU;
-    INSMem myInsMem;
-    DataMem myDataMem;
+    INSMem myInsMem(mmu ? &*mmu : nullptr);
+    DataMem myDataMem(mmu ? &*mmu : nullptr);
 
     unsigned PC = 0;
-    while (PC < MemSize) {
+    while (PC < MemSize) try {
         // Fetch:
         //     Fetch an instruction from myInsMem.
         dout << debug::bg::cyan << " INST " << debug::reset
@@ -419,8 +460,15 @@ int main() {
 
         /**** You don't need to modify the following lines. ****/
         myRF.OutputRF();  // dump RF;
+    } catch (const vm::PageFault& fault) {
+        // the instruction faulted before writing back, stop there
+        cout << fault.what() << ", PC=0x" << hex << PC << dec << endl;
+        break;
     }
     myDataMem.OutputDataMem();  // dump data mem
+    if (mmu) {
+        mmu->report(cout);
+    }
 
     return 0;
 }
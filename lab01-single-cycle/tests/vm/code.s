@@ -0,0 +1,12 @@
+# Virtual memory: page 0 is the code, mapped to frame 0; page 1 is mapped to
+# frame 2; page 2 is not mapped
+addiu r1 r0 256  # r1 = 0x100, page 1
+lw r2 r1 0       # load [0x100], physical 0x200
+addiu r3 r2 1
+sw r3 r1 4       # store [0x104], physical 0x204
+lw r4 r1 4       # load [0x104], physical 0x204
+addiu r5 r1 256  # r5 = 0x200, page 2
+lw r6 r5 0       # page fault, the core stops here
+addiu r7 r0 1    # never executed
+
+halt
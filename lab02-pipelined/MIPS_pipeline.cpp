@@ -3,9 +3,12 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <optional>
 #include <string>
 #include <vector>
 
+#include "../lab04-page-table/vm.h"
+
 #ifdef DEBUG
 #include "../debug.h"
 #else
@@ -179,7 +182,8 @@ class RF {
 class INSMem {
    public:
     bitset< 32 > Instruction;
-    INSMem() {
+    // mmu: translates fetch addresses, nullptr for physical addressing
+    explicit INSMem(vm::Mmu* mmu_ = nullptr) : mmu(mmu_) {
         IMem.resize(MemSize);
         ifstream imem;
         string line;
@@ -196,6 +200,10 @@ class INSMem {
     }
 
     bitset< 32 > readInstr(bitset< 32 > ReadAddress) {
+        if (mmu) {
+            ReadAddress =
+                mmu->translate(ReadAddress.to_ulong(), vm::access::fetch);
+        }
         string insmem;
         insmem.append(IMem[ReadAddress.to_ulong()].to_string());
         insmem.append(IMem[ReadAddress.to_ulong() + 1].to_string());
@@ -216,12 +224,15 @@ class INSMem {
 
    private:
     vector< bitset< 8 > > IMem;
+    vm::Mmu* mmu;
 };
 
 class DataMem {
    public:
     bitset< 32 > ReadData;
-    DataMem() {
+    // mmu: translates load and store addresses, nullptr for physical
+    // addressing
+    explicit DataMem(vm::Mmu* mmu_ = nullptr) : mmu(mmu_) {
         DMem.resize(MemSize);
         ifstream dmem;
         string line;
@@ -238,6 +249,9 @@ class DataMem {
     }
 
     bitset< 32 > readDataMem(bitset< 32 > Address) {
+        if (mmu) {
+            Address = mmu->translate(Address.to_ulong(), vm::access::load);
+        }
         string datamem;
         datamem.append(DMem[Address.to_ulong()].to_string());
         datamem.append(DMem[Address.to_ulong() + 1].to_string());
@@ -257,6 +271,9 @@ class DataMem {
     }
 
     void writeDataMem(bitset< 32 > Address, bitset< 32 > WriteData) {
+        if (mmu) {
+            Address = mmu->translate(Address.to_ulong(), vm::access::store);
+        }
         DMem[Address.to_ulong()] =
             bitset< 8 >(WriteData.to_string().substr(0, 8));
         DMem[Address.to_ulong() + 1] =
@@ -290,6 +307,7 @@ class DataMem {
 
    private:
     vector< bitset< 8 > > DMem;
+    vm::Mmu* mmu;
 };
 
 void printState(stateStruct state, int cycle) {
@@ -338,10 +356,29 @@ void printState(stateStruct state, int cycle) {
     printstate.close();
 }
 
+void printStall(int cycle) {
+    // a cycle spent on a page walk: no stage moved, so instead of the
+    // pipeline registers only a marker is dumped
+    ofstream printstate;
+    printstate.open("stateresult.txt", std::ios_base::app);
+    if (printstate.is_open()) {
+        printstate << "State after executing cycle:\t" << cycle << endl;
+        printstate << "stall:\tpage walk, pipeline registers held" << endl;
+    } else
+        cout << "Unable to open file";
+    printstate.close();
+}
+
 int main() {
+    // PTBR=<file> runs the program in a virtual address space (vm.h)
+    std::optional< vm::Mmu > mmu;
+    if (const auto config = vm::Config::from_env()) {
+        mmu.emplace(*config, MemSize);
+    }
+
     RF myRF;
-    INSMem myInsMem;
-    DataMem myDataMem;
+    INSMem myInsMem(mmu ? &*mmu : nullptr);
+    DataMem myDataMem(mmu ? &*mmu : nullptr);
 
     stateStruct state;
     {  // IF
@@ -391,8 +428,9 @@ int main() {
     }
     stateStruct newState = state;
     int cycle = 0;
+    int walk_stall_cycles = 0;
 
-    while (1) {
+    while (1) try {
         dout << "\n"
                 "================================"
                 "================================"
@@ -423,10 +461,13 @@ int main() {
                     if (state.MEM.wrt_mem) {  // sw
                         myDataMem.writeDataMem(state.MEM.ALUresult,
                                                state.MEM.Store_data);
+                        // the word just stored, without reading it back
+                        // (and translating its address a second time)
+                        newState.WB.Wrt_data = state.MEM.Store_data;
+                    } else {  // lw
+                        newState.WB.Wrt_data =
+                            myDataMem.readDataMem(state.MEM.ALUresult);
                     }
-                    // lw
-                    newState.WB.Wrt_data =
-                        myDataMem.readDataMem(state.MEM.ALUresult);
                 } else {
                     newState.WB.Wrt_data = state.MEM.ALUresult;
                 }
@@ -748,6 +789,16 @@ int main() {
             state.WB.nop)
             break;
 
+        // page walks of TLB misses hold the whole pipeline until they are
+        // done, the cycle's results land after the walk cycles; the dump
+        // has a stall marker for each walk cycle, then this cycle's state
+        for (unsigned stall = mmu ? mmu->take_walk_cycles() : 0; stall > 0;
+             stall--) {
+            printStall(cycle);
+            ++cycle;
+            ++walk_stall_cycles;
+        }
+
         printState(newState, cycle);  // print states after executing cycle 0,
                                       // cycle 1, cycle 2 ...
 
@@ -756,10 +807,22 @@ int main() {
          * updates the current state with the values calculated in this cycle.
          */
         ++cycle;
+    } catch (const vm::PageFault& fault) {
+        // the pipeline registers keep the state before the faulting cycle,
+        // but the instructions ahead of the faulting one have already
+        // written the RF (WB) and memory (MEM) in it, as a precise
+        // exception lets them
+        cout << fault.what() << " in cycle " << cycle << endl;
+        break;
     }
 
     myRF.outputRF();            // dump RF;
     myDataMem.outputDataMem();  // dump data mem
+    if (mmu) {
+        mmu->report(cout);
+        cout << "page-walk stall cycles: " << walk_stall_cycles << " of "
+             << cycle << endl;
+    }
 
     return 0;
 }
@@ -0,0 +1,239 @@
+/* Memory access streams
+
+The cache simulator consumes accesses one at a time from a Source, so a trace
+never has to be held in memory and may come from a pipe or a FIFO as it is
+produced:
+- TextSource     "<R|W> <hex address>" lines, the lab's trace format, with
+                 an optional third column: the access's cycle (decimal)
+- BinarySource   the binary format below
+- Channel        bounded in-process queue, a producer thread push()es
+                 accesses and close()s it when done; the consumer may close()
+                 it early, push() then returns false
+
+Binary format, little-endian:
+- header, 8 bytes: magic "CTRB", format version (1) as 4 bytes
+- records, 8 bytes each: address (4 bytes), 'R' or 'W' (1 byte), 3 reserved
+  zero bytes
+A stream is recognized as binary by its first byte, which is never 'C' in a
+text trace.
+
+Writer produces either format, e.g. for a CPU simulator streaming its loads
+and stores into a pipe the cache simulator reads from.
+*/
+
+#ifndef ACCESS_STREAM_H_
+#define ACCESS_STREAM_H_
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <istream>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+
+namespace access_stream {
+
+constexpr std::array< char, 4 > magic = {'C', 'T', 'R', 'B'};
+constexpr std::uint32_t version = 1;
+constexpr std::size_t record_size = 8;
+
+inline const char* parse_fields(const char* p, char& accesstype,
+                                unsigned& addr) {
+    // "<R|W> <hex address>" without the stringstream round trips
+    // return value: where the address ends, nullptr if there is none
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    if (*p == '\0') {
+        return nullptr;
+    }
+    accesstype = *p++;
+    char* end = nullptr;
+    addr = std::strtoul(p, &end, 16);
+    return end != p ? end : nullptr;
+}
+
+inline bool parse_access(const std::string& line, char& accesstype,
+                         unsigned& addr) {
+    return parse_fields(line.c_str(), accesstype, addr) != nullptr;
+}
+
+class Source {
+   public:
+    virtual ~Source() = default;
+    // returns false at the end of the stream
+    virtual bool next(char& accesstype, unsigned& addr) = 0;
+
+    // cycle of the access next() returned last, if the stream has them
+    std::optional< std::uint64_t > time;
+};
+
+class TextSource : public Source {
+   public:
+    explicit TextSource(std::istream& in_) : in(in_) {}
+
+    bool next(char& accesstype, unsigned& addr) override {
+        if (!std::getline(in, line)) {
+            return false;
+        }
+        const char* rest = parse_fields(line.c_str(), accesstype, addr);
+        if (rest == nullptr) {
+            return false;
+        }
+        char* end = nullptr;
+        const auto cycle = std::strtoull(rest, &end, 10);
+        time = end != rest ? std::optional< std::uint64_t >(cycle)
+                           : std::nullopt;
+        return true;
+    }
+
+   private:
+    std::istream& in;
+    std::string line;
+};
+
+class BinarySource : public Source {
+   public:
+    // the header has to be consumed already, see Opened
+    explicit BinarySource(std::istream& in_) : in(in_) {}
+
+    bool next(char& accesstype, unsigned& addr) override {
+        if (pos == filled) {
+            in.read(buffer.data(), buffer.size());
+            filled = in.gcount() - in.gcount() % record_size;
+            pos = 0;
+            if (filled == 0) {
+                return false;
+            }
+        }
+        const auto* record =
+            reinterpret_cast< const unsigned char* >(buffer.data() + pos);
+        addr = record[0] | record[1] << 8 | record[2] << 16 |
+               static_cast< unsigned >(record[3]) << 24;
+        accesstype = static_cast< char >(record[4]);
+        pos += record_size;
+        return true;
+    }
+
+   private:
+    std::istream& in;
+    std::array< char, 512 * record_size > buffer;
+    std::size_t pos = 0;
+    std::size_t filled = 0;
+};
+
+class Channel : public Source {
+    // single producer, single consumer, at most `capacity` accesses queued
+   public:
+    explicit Channel(std::size_t capacity_ = 1 << 16) : capacity(capacity_) {}
+
+    // returns false once the channel is closed
+    bool push(char accesstype, unsigned addr,
+              std::optional< std::uint64_t > cycle = std::nullopt) {
+        std::unique_lock< std::mutex > lock(mutex);
+        not_full.wait(lock, [&] { return queue.size() < capacity || closed; });
+        if (closed) {
+            return false;
+        }
+        queue.push_back({accesstype, addr, cycle});
+        not_empty.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard< std::mutex > lock(mutex);
+        closed = true;
+        not_empty.notify_one();
+        not_full.notify_one();
+    }
+
+    bool next(char& accesstype, unsigned& addr) override {
+        std::unique_lock< std::mutex > lock(mutex);
+        not_empty.wait(lock, [&] { return !queue.empty() || closed; });
+        if (queue.empty()) {
+            return false;
+        }
+        std::tie(accesstype, addr, time) = queue.front();
+        queue.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+   private:
+    std::size_t capacity;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::deque< std::tuple< char, unsigned, std::optional< std::uint64_t > > >
+        queue;
+    bool closed = false;
+};
+
+class Opened {
+    // a Source over `in` in whichever format it turns out to be
+   public:
+    explicit Opened(std::istream& in) : text(in), binary(in) {
+        if (in.peek() == magic[0]) {
+            char header[8];
+            in.read(header, sizeof(header));
+            if (!in || std::memcmp(header, magic.data(), magic.size()) != 0 ||
+                header[4] != static_cast< char >(version)) {
+                throw std::invalid_argument("bad binary access stream header");
+            }
+            is_binary = true;
+        }
+    }
+
+    Source& source() {
+        return is_binary ? static_cast< Source& >(binary) : text;
+    }
+
+   private:
+    TextSource text;
+    BinarySource binary;
+    bool is_binary = false;
+};
+
+class Writer {
+   public:
+    Writer(std::ostream& out_, bool binary_) : out(out_), binary(binary_) {
+        if (binary) {
+            out.write(magic.data(), magic.size());
+            const char v[4] = {static_cast< char >(version), 0, 0, 0};
+            out.write(v, sizeof(v));
+        }
+    }
+
+    void record(char accesstype, unsigned addr) {
+        if (binary) {
+            const char record[record_size] = {
+                static_cast< char >(addr & 0xff),
+                static_cast< char >((addr >> 8) & 0xff),
+                static_cast< char >((addr >> 16) & 0xff),
+                static_cast< char >((addr >> 24) & 0xff),
+                accesstype};
+            out.write(record, record_size);
+        } else {
+            char line[16];
+            std::snprintf(line, sizeof(line), "%c %08x\n", accesstype, addr);
+            out << line;
+        }
+    }
+
+   private:
+    std::ostream& out;
+    bool binary;
+};
+
+}  // namespace access_stream
+
+#endif
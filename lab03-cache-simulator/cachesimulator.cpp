@@ -23,21 +23,114 @@ The 32 bit address is divided into
 - Offset Bits:
     - the offset field is used to determine which byte in the block is being
       accessed.
+
+The config file may name a replacement policy after the cache parameters,
+e.g. "policy: lru" (see replacement.h), round-robin is used otherwise.
+A prefetcher (see prefetch.h) is configured the same way:
+    prefetcher: stride
+    prefetch_level: 1
+    prefetch_degree: 2
+    prefetch_distance: 4
+and a DRAM timing model below L2 (see dram.h) with any of
+    dram_channels: 2
+    dram_banks: 8
+    dram_row_bytes: 2048
+    dram_page: open | closed
+    tRCD: 14
+    tCAS: 14
+    tRP: 14
+    dram_burst: 4
+    dram_interval: 10
+("dram: on" enables it with the defaults), which adds memory latency and
+row-buffer statistics to <trace>.summary. A non-blocking timing model (see
+mshr.h) is configured the same way:
+    mshrs_l1: 8
+    mshrs_l2: 16
+    latency_l1: 1
+    latency_l2: 10
+    latency_mem: 100
+    mshr_interval: 1
+("mshr: on" for the defaults); trace lines may then carry the access cycle
+as a third column, "R 1a2b3c 1200".
+
+Geometries listed in `common_geometries` get a Cache specialized at compile
+time (constant shifts and masks, fixed-size sets without bound checks), any
+other configuration runs on the generic runtime-sized path.
+
+With --coherence the trace has a core ID column ("<core> <R|W> <address>"),
+or several per-core traces are given as "t0.txt,t1.txt,...", and every core
+gets a private L1 kept coherent under MESI (see coherence.h) over a shared L2.
+
+--export-l2=<file> records what reaches L2 during a run (l2trace.h), and
+--replay-l2 runs only the L2 of a config on such a file, for L2 sweeps that
+keep L1 fixed.
+
+--timeseries=<file> writes hit, miss and writeback rates and the working-set
+size per window of --window=<N> accesses, with phases detected from
+working-set signatures (see timeseries.h).
+
+--bench[=<results>] (in place of <config> <trace>) measures the simulator's
+own throughput on generated streams, see run_bench and synthetic.h.
+
+--save-snapshot=<file> stores both levels and the policy state after a
+warm-up run, --load-snapshot=<file> starts a run from it (see snapshot.h).
+
+The trace may also be "-" for stdin or a FIFO, in text or the binary access
+format of access_stream.h; results then go to stdin.out for "-". Accesses are
+simulated as they arrive, e.g. from the lab 1 MIPS simulator run with
+MEMTRACE=<fifo>.
+
+More than two levels ("L3:", ...) or per-level policies run on CacheHierarchy
+instead; these lines apply to the level right above them:
+    inclusion: inclusive | exclusive | nine   (towards the upper level)
+    write: back | through
+    allocate: yes | no                        (write-allocate)
+Levels default to exclusive, write-back, no-allocate, which is how the lab's
+L1/L2 pair behaves; a level whose block size differs from the level above
+defaults to nine instead, since an exclusive level takes the upper level's
+victims block for block. Each output line then has one code per level (0 for a
+level the access never reached) followed by the memory write code.
 */
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <bitset>
+#include <chrono>
+#include <climits>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include <sys/stat.h>
+
+#include "access_stream.h"
+#include "coherence.h"
+#include "dram.h"
+#include "l2trace.h"
+#include "mrc.h"
+#include "mshr.h"
+#include "prefetch.h"
+#include "replacement.h"
+#include "snapshot.h"
+#include "synthetic.h"
+#include "three_c.h"
+#include "timeseries.h"
+
 #ifdef DEBUG
 #include "../debug.h"
 #else
@@ -110,6 +203,17 @@ using namespace std;
 enum class read_request { hit = RH, miss = RM };
 enum class write_request { hit = WH, miss = WM };
 
+enum class inclusion { inclusive, exclusive, nine };
+
+struct LevelConfig {
+    int blocksize;
+    int setsize;  // associativity
+    int size;     // KiB
+    inclusion incl = inclusion::exclusive;  // towards the level above
+    bool write_back = true;
+    bool write_allocate = false;
+};
+
 struct Config {
     int L1blocksize;
     int L1setsize;
@@ -117,6 +221,22 @@ struct Config {
     int L2blocksize;
     int L2setsize;
     int L2size;
+    string policy = replacement::RoundRobin::name;
+    string prefetcher = "none";
+    int prefetch_level = 1;
+    prefetch::Params prefetch_params;
+    std::optional< dram::Params > dram;  // timing model below L2
+    std::optional< mshr::Params > mshr;  // non-blocking timing
+
+    // every level as read, L1/L2 above mirror the first two
+    std::vector< LevelConfig > levels;
+    // per-level attributes were given, simulate with CacheHierarchy
+    bool extended = false;
+
+    bool needs_hierarchy() const {
+        return extended || levels.size() != 2 ||
+               L1blocksize != L2blocksize;
+    }
 };
 
 struct CacheBlock {
@@ -138,27 +258,54 @@ struct CacheBlock {
 
     CacheBlock() : CacheBlock(0, 0, 0) {}
 
+    template < typename Archive >
+    void serialize(Archive& ar) {
+        ar(tag);
+        ar(valid);
+        ar(dirty);
+        ar(prefetched);
+    }
+
     unsigned tag;
     bool valid;
     bool dirty;
+    bool prefetched = false;  // filled by a prefetch and not demanded yet
 };
 
+constexpr int dynamic_ways = 0;
+
+template < typename Policy, int Ways = dynamic_ways >
 struct CacheSet {
     /*
      * a cache set:
-     *   - a vector of CacheBlocks
-     *   - a counter to keep track of which block to evict next
+     *   - CacheBlocks, a vector or a fixed-size array when the number of ways
+     *     is known at compile time
+     *   - the replacement policy state to decide which block to evict next
      */
-    CacheSet(int size_) : size(size_) { blocks.resize(size, CacheBlock()); }
+    using storage_type =
+        std::conditional_t< Ways == dynamic_ways, std::vector< CacheBlock >,
+                            std::array< CacheBlock, Ways > >;
+
+    CacheSet(int size_) : policy(size_), size(size_) {
+        if constexpr (Ways == dynamic_ways) {
+            blocks.resize(size, CacheBlock());
+        } else if (size != Ways) {
+            throw std::invalid_argument("associativity mismatch");
+        }
+    }
     CacheBlock& operator[](int index) {
-        if (index > size) {
-            throw std::out_of_range("index out of bound");
+        if constexpr (Ways == dynamic_ways) {
+            if (index >= size) {
+                throw std::out_of_range("index out of bound");
+            }
         }
         return blocks[index];
     }
     const CacheBlock& operator[](int index) const {
-        if (index > size) {
-            throw std::out_of_range("index out of bound");
+        if constexpr (Ways == dynamic_ways) {
+            if (index >= size) {
+                throw std::out_of_range("index out of bound");
+            }
         }
         return blocks[index];
     }
@@ -190,14 +337,30 @@ struct CacheSet {
         }
     }
 
-    auto evict_who() {
-        const auto copied_eviction_ptr = eviction_ptr;
-        eviction_ptr = (eviction_ptr + 1) % size;
-        return copied_eviction_ptr;
+    auto evict_who() { return policy.victim(); }
+
+    template < typename Iter >
+    void touch(Iter block) {
+        policy.on_hit(block - blocks.begin());
+    }
+
+    template < typename Iter >
+    void fill(Iter spot, const CacheBlock& block) {
+        *spot = block;
+        policy.on_fill(spot - blocks.begin());
     }
 
-    std::vector< CacheBlock > blocks = {CacheBlock()};
-    int eviction_ptr = 0;
+    template < typename Archive >
+    void serialize(Archive& ar) {
+        // the way count is fixed by the config, blocks are not resized
+        for (auto& block : blocks) {
+            ar(block);
+        }
+        ar(policy);
+    }
+
+    storage_type blocks = {CacheBlock()};
+    Policy policy;
 
    private:
     int size;  // number of ways
@@ -205,6 +368,20 @@ struct CacheSet {
 
 constexpr long bitmask(unsigned n) { return (1UL << n) - 1; }
 
+constexpr int ceil_log2(long n) {
+    int bits = 0;
+    while ((1L << bits) < n) {
+        bits++;
+    }
+    return bits;
+}
+
+struct ParsedAddress {
+    unsigned tag;
+    unsigned index;
+    unsigned offset;
+};
+
 class CacheAddress {
     /*
      * |------------------------|
@@ -221,6 +398,8 @@ class CacheAddress {
      *      - b = log2(block size in bytes)
      */
    public:
+    static constexpr int ways = dynamic_ways;
+
     CacheAddress(int level_, int block_size, int set_size_, int total_size_)
         : index_size(std::lround(std::ceil(
               std::log2(total_size_ * 1024 / block_size / set_size_)))),
@@ -233,14 +412,21 @@ class CacheAddress {
              << index_size << "> / <offset " << offset_size << ">" << endl;
     }
 
-    auto parse(unsigned address) {
-        return std::make_tuple(
+    ParsedAddress parse(unsigned address) const {
+        return {
             // tag bits
-            ((address >> (offset_size + index_size)) & bitmask(tag_size)),
+            static_cast< unsigned >((address >> (offset_size + index_size)) &
+                                    bitmask(tag_size)),
             // index bits
-            ((address >> offset_size) & bitmask(index_size)),
+            static_cast< unsigned >((address >> offset_size) &
+                                    bitmask(index_size)),
             // offset bits
-            (address & bitmask(offset_size)));
+            static_cast< unsigned >(address & bitmask(offset_size))};
+    }
+
+    unsigned block_addr(unsigned tag, unsigned index) const {
+        return ((tag & bitmask(tag_size)) << (offset_size + index_size)) |
+               ((index & bitmask(index_size)) << offset_size);
     }
 
     int index_size;
@@ -248,13 +434,53 @@ class CacheAddress {
     int tag_size;
 };
 
+template < int BlockSize, int Ways, int Sets >
+class FixedCacheAddress {
+    /*
+     * CacheAddress with the geometry fixed at compile time, every shift and
+     * mask in parse() is a constant
+     */
+   public:
+    static_assert((BlockSize & (BlockSize - 1)) == 0, "block size not 2^n");
+    static_assert((Sets & (Sets - 1)) == 0, "number of sets not 2^n");
+
+    static constexpr int ways = Ways;
+    static constexpr int index_size = ceil_log2(Sets);
+    static constexpr int offset_size = ceil_log2(BlockSize);
+    static constexpr int tag_size = 32 - index_size - offset_size;
+
+    FixedCacheAddress(int level_, int block_size, int set_size_,
+                      int total_size_) {
+        if (block_size != BlockSize || set_size_ != Ways ||
+            total_size_ * 1024 / block_size / set_size_ != Sets) {
+            throw std::invalid_argument("geometry mismatch");
+        }
+        dout << "L" << level_ << " addr: <tag " << tag_size << "> / <index "
+             << index_size << "> / <offset " << offset_size << "> (fixed)"
+             << endl;
+    }
+
+    static constexpr ParsedAddress parse(unsigned address) {
+        return {static_cast< unsigned >(address >> (offset_size + index_size)),
+                static_cast< unsigned >((address >> offset_size) &
+                                        bitmask(index_size)),
+                static_cast< unsigned >(address & bitmask(offset_size))};
+    }
+
+    static constexpr unsigned block_addr(unsigned tag, unsigned index) {
+        return (tag << (offset_size + index_size)) | (index << offset_size);
+    }
+};
+
+template < typename Policy, typename Address = CacheAddress >
 class Cache {
    public:
-    Cache(int block_size_, int num_ways_, int total_size_,
-          CacheAddress addr_sys_)
-        : sets({CacheSet(num_ways_)}), addr_sys(addr_sys_) {
+    using set_type = CacheSet< Policy, Address::ways >;
+
+    Cache(int block_size_, int num_ways_, int total_size_, Address addr_sys_)
+        : sets({set_type(num_ways_)}), addr_sys(addr_sys_) {
         const auto num_sets = total_size_ * 1024 / block_size_ / num_ways_;
-        sets.resize(num_sets, CacheSet(num_ways_));
+        sets.resize(num_sets, set_type(num_ways_));
     }
 
     read_request read(unsigned addr) {
@@ -263,6 +489,8 @@ class Cache {
         const auto found = set.search(tag);
 
         if (found != set.cend()) {
+            set.touch(found);
+            demand_use(*found);
             return read_request::hit;
         } else {
             return read_request::miss;
@@ -276,24 +504,48 @@ class Cache {
 
         if (found != set.cend()) {
             found->dirty = true;
+            set.touch(found);
+            demand_use(*found);
             return write_request::hit;
         } else {
             return write_request::miss;
         }
     };
 
-    std::vector< CacheSet > sets;
-    CacheAddress addr_sys;
+    bool contains(unsigned addr) {
+        const auto& [tag, index, offset] = addr_sys.parse(addr);
+        return sets[index].search(tag) != sets[index].cend();
+    }
+
+    template < typename Archive >
+    void serialize(Archive& ar) {
+        for (auto& set : sets) {
+            ar(set);
+        }
+    }
+
+    void demand_use(CacheBlock& block) {
+        if (block.prefetched) {
+            block.prefetched = false;
+            prefetched_hits++;
+        }
+    }
+
+    std::vector< set_type > sets;
+    Address addr_sys;
+    std::uint64_t prefetched_hits = 0;  // first demand hits on prefetches
 };
 
+template < typename Policy, typename L1Address = CacheAddress,
+           typename L2Address = CacheAddress >
 class CacheSystem {
    public:
     CacheSystem(Config cfg)
         : l1_cache(cfg.L1blocksize, cfg.L1setsize, cfg.L1size,
-                   CacheAddress(1, cfg.L1blocksize, cfg.L1setsize, cfg.L1size)),
-          l2_cache(
-              cfg.L2blocksize, cfg.L2setsize, cfg.L2size,
-              CacheAddress(2, cfg.L2blocksize, cfg.L2setsize, cfg.L2size)) {}
+                   L1Address(1, cfg.L1blocksize, cfg.L1setsize, cfg.L1size)),
+          l2_cache(cfg.L2blocksize, cfg.L2setsize, cfg.L2size,
+                   L2Address(2, cfg.L2blocksize, cfg.L2setsize, cfg.L2size)) {
+    }
 
     bool l2_evict(unsigned addr) {
         // return value: <bool> did_write_to_mem ?
@@ -312,9 +564,18 @@ class CacheSystem {
 
         auto evict_idx = set.evict_who();
         set[evict_idx].valid = false;
+        last_l2_victim =
+            l2_cache.addr_sys.block_addr(set[evict_idx].tag, index);
+        if (set[evict_idx].prefetched && prefetcher) {
+            prefetcher->on_unused_eviction(last_l2_victim >>
+                                           l2_cache.addr_sys.offset_size);
+        }
 
         // pseudo-op: write to mem
         const bool did_write_to_mem = set[evict_idx].dirty;
+        if (did_write_to_mem && dram) {
+            dram->write(last_l2_victim);
+        }
         return did_write_to_mem;
     }
 
@@ -338,28 +599,32 @@ class CacheSystem {
         auto& evicted_block = l1_set[evict_idx];
 
         // reconstruct addr of the evicted L1 block
-        unsigned evicted_l1_block_addr =
-            // tag
-            ((evicted_block.tag & bitmask(l1_cache.addr_sys.tag_size))
-             << (l1_cache.addr_sys.offset_size +
-                 l1_cache.addr_sys.index_size)) |
-            // index
-            ((l1_index & bitmask(l1_cache.addr_sys.index_size))
-             << l1_cache.addr_sys.offset_size) |
-            // offset
-            (0 & bitmask(l1_cache.addr_sys.offset_size));
+        const unsigned evicted_l1_block_addr =
+            l1_cache.addr_sys.block_addr(evicted_block.tag, l1_index);
+        last_l1_victim = evicted_l1_block_addr;
+        last_l1_victim_dirty = evicted_block.dirty;
+        l1_evictions++;
+
+        // move L1_evicted to L2
+        const bool did_write_to_mem =
+            this->l2_insert(evicted_l1_block_addr, evicted_block);
+        evicted_block.valid = false;
 
+        return did_write_to_mem;
+    }
+
+    bool l2_insert(unsigned block_addr, CacheBlock block) {
+        // return value: <bool> did_write_to_mem ?
         bool did_write_to_mem = false;
 
-        // move L1_evicted to L2
-        // search empty spot in L2 with evicted_L1_block_addr
+        // search empty spot in L2 with block_addr
         const auto& [l2_tag, l2_index, l2_offset] =
-            l2_cache.addr_sys.parse(evicted_l1_block_addr);
+            l2_cache.addr_sys.parse(block_addr);
         auto& l2_set = l2_cache.sets[l2_index];
 
         if (l2_set.is_full()) {
             // evict L2
-            did_write_to_mem = this->l2_evict(evicted_l1_block_addr);
+            did_write_to_mem = this->l2_evict(block_addr);
         }
 
         // insert L1_evicted to L2
@@ -371,9 +636,8 @@ class CacheSystem {
                 "cannot find empty spot right after eviction");
         }
         auto l2_empty_spot = l2_set.find_space();
-        *l2_empty_spot = evicted_block;
-
-        evicted_block.valid = false;
+        block.tag = l2_tag;  // tag widths differ per level
+        l2_set.fill(l2_empty_spot, block);
 
         return did_write_to_mem;
     }
@@ -401,48 +665,17 @@ class CacheSystem {
                 CacheBlock copied_block = *l2_found;
                 l2_found->valid = false;
 
-                // - find empty spot in L1
-                const auto& [l1_tag, l1_index, l1_offset] =
-                    l1_cache.addr_sys.parse(addr);
-                auto& l1_set = l1_cache.sets[l1_index];
-                if (l1_set.has_space()) {
-                    // found empty spot
-                    auto empty_spot = l1_set.find_space();
-                    *empty_spot = copied_block;
-                } else {
-                    // did not find empty spot, need to evict someone from L1
-                    did_write_to_mem = this->l1_evict(addr) || did_write_to_mem;
-                    // place "evicted L1 block" into L2
-                    // search empty spot in L1 again
-                    if (l1_set.is_full()) {
-                        dout << debug::bg::red
-                             << "cannot find empty spot right after eviction"
-                             << debug::reset << endl;
-                        throw std::runtime_error(
-                            "cannot find empty spot right after eviction");
-                    }
-                    auto l1_empty_spot_after_eviction = l1_set.find_space();
-                    *l1_empty_spot_after_eviction = copied_block;
-                }
-                return make_tuple(RM, RM,
+                // - place it in L1
+                did_write_to_mem = this->place_in_l1(addr, copied_block);
+                return make_tuple(RM, RH,
                                   did_write_to_mem ? WRITEMEM : NOWRITEMEM);
             } else {  // L2 miss
                 dout << debug::red << "L2 miss" << debug::reset << endl;
-                bool did_write_to_mem = false;
-
-                // search for empty spot in L1
-                const auto& [tag, index, offset] =
-                    l1_cache.addr_sys.parse(addr);
-                auto& set = l1_cache.sets[index];
-                // if L1 full, evict
-                if (set.is_full()) {
-                    did_write_to_mem = this->l1_evict(addr) || did_write_to_mem;
-                    // try inserting to L1 again
-                    auto l1_empty_spot = set.find_space();
-                    l1_empty_spot->tag = tag;
-                    l1_empty_spot->dirty = false;
-                    l1_empty_spot->valid = true;
+                if (dram) {
+                    dram->read(addr);
                 }
+                const bool did_write_to_mem =
+                    this->place_in_l1(addr, CacheBlock(0, true, false));
 
                 return make_tuple(RM, RM,
                                   did_write_to_mem ? WRITEMEM : NOWRITEMEM);
@@ -450,6 +683,37 @@ class CacheSystem {
         }
     };
 
+    bool place_in_l1(unsigned addr, CacheBlock block) {
+        // return value: <bool> did_write_to_mem ?
+        bool did_write_to_mem = false;
+
+        // - find empty spot in L1
+        const auto& [l1_tag, l1_index, l1_offset] =
+            l1_cache.addr_sys.parse(addr);
+        block.tag = l1_tag;  // tag widths differ per level
+        auto& l1_set = l1_cache.sets[l1_index];
+        if (l1_set.has_space()) {
+            // found empty spot
+            auto empty_spot = l1_set.find_space();
+            l1_set.fill(empty_spot, block);
+        } else {
+            // did not find empty spot, need to evict someone from L1
+            did_write_to_mem = this->l1_evict(addr) || did_write_to_mem;
+            // place "evicted L1 block" into L2
+            // search empty spot in L1 again
+            if (l1_set.is_full()) {
+                dout << debug::bg::red
+                     << "cannot find empty spot right after eviction"
+                     << debug::reset << endl;
+                throw std::runtime_error(
+                    "cannot find empty spot right after eviction");
+            }
+            auto l1_empty_spot_after_eviction = l1_set.find_space();
+            l1_set.fill(l1_empty_spot_after_eviction, block);
+        }
+        return did_write_to_mem;
+    }
+
     auto write(unsigned addr) {
         if (l1_cache.write(addr) == write_request::hit) {
             dout << debug::green << "L1 hit" << debug::reset << endl;
@@ -461,86 +725,1995 @@ class CacheSystem {
                 return make_tuple(WM, WH, NOWRITEMEM);
             } else {
                 dout << debug::red << "L2 miss" << debug::reset << endl;
+                if (dram) {
+                    dram->write(addr);
+                }
                 return make_tuple(WM, WM, WRITEMEM);
             }
         }
     };
 
-    Cache l1_cache;
-    Cache l2_cache;
-};
+    auto access(char accesstype, unsigned addr) {
+        const auto l1_useful = l1_cache.prefetched_hits;
+        const auto l2_useful = l2_cache.prefetched_hits;
+        const auto evictions = l1_evictions;
+        if (dram) {
+            dram->tick();
+        }
+        const auto result = accesstype == 'R' ? read(addr) : write(addr);
+        if (miss_classes) {
+            classify(addr, result, evictions != l1_evictions);
+        }
+        if (l2_export && std::get< 1 >(result) != NA) {
+            l2_export->record(addr, accesstype == 'R' ? l2trace::read
+                                                      : l2trace::write);
+            if (evictions != l1_evictions) {
+                l2_export->record(last_l1_victim,
+                                  last_l1_victim_dirty ? l2trace::insert_dirty
+                                                       : l2trace::insert);
+            }
+        }
+        if (prefetcher) {
+            const bool used = l1_useful != l1_cache.prefetched_hits ||
+                              l2_useful != l2_cache.prefetched_hits;
+            run_prefetcher(addr, result, used);
+        }
+        return result;
+    }
 
-int main(int argc, char* argv[]) {
-    Config cacheconfig;
-    {
-        ifstream cache_params;
-        string dummyLine;
-        cache_params.open(argv[1]);
-        while (!cache_params.eof()) {
-            // read config file
-            cache_params >> dummyLine;                // L1:
-            cache_params >> cacheconfig.L1blocksize;  // L1 Block size
-            cache_params >> cacheconfig.L1setsize;    // L1 Associativity
-            cache_params >> cacheconfig.L1size;       // L1 Cache Size
-            cache_params >> dummyLine;                // L2:
-            cache_params >> cacheconfig.L2blocksize;  // L2 Block size
-            cache_params >> cacheconfig.L2setsize;    // L2 Associativity
-            cache_params >> cacheconfig.L2size;       // L2 Cache Size
-        }
-    }
-
-    ifstream traces;
-    ofstream tracesout;
-    const auto outname = string(argv[2]) + ".out";
-    traces.open(argv[2]);
-    tracesout.open(outname.c_str());
+    auto replay(const l2trace::Record& record) {
+        /*
+         * the L2 side of one record of an L1-filtered trace
+         *
+         * return value: <L2 hit/miss code or NA for inserts, did_write_to_mem>
+         */
+        switch (record.type) {
+            case l2trace::read: {
+                const auto& [tag, index, offset] =
+                    l2_cache.addr_sys.parse(record.addr);
+                auto& set = l2_cache.sets[index];
+                const auto found = set.search(tag);
+                if (found == set.cend()) {
+                    return make_pair(RM, false);
+                }
+                set.touch(found);
+                found->valid = false;  // moved up to L1
+                return make_pair(RH, false);
+            }
+            case l2trace::write:
+                if (l2_cache.write(record.addr) == write_request::hit) {
+                    return make_pair(WH, false);
+                }
+                return make_pair(WM, true);
+            default:
+                return make_pair(
+                    NA, this->l2_insert(
+                            record.addr,
+                            CacheBlock(0, true,
+                                       record.type == l2trace::insert_dirty)));
+        }
+    }
 
-    if (cacheconfig.L1blocksize != cacheconfig.L2blocksize) {
-        printf("please test with the same block size\n");
-        return 1;
+    void save_snapshot(const string& filename, const Config& cfg) {
+        snapshot::Writer ar(filename);
+        ar(cfg.policy);
+        for (const int value : {cfg.L1blocksize, cfg.L1setsize, cfg.L1size,
+                                cfg.L2blocksize, cfg.L2setsize, cfg.L2size}) {
+            ar(value);
+        }
+        ar(l1_cache);
+        ar(l2_cache);
+    }
+
+    void load_snapshot(const string& filename, const Config& cfg) {
+        snapshot::Reader ar(filename);
+        ar.expect(cfg.policy, "replacement policy");
+        for (const int value : {cfg.L1blocksize, cfg.L1setsize, cfg.L1size,
+                                cfg.L2blocksize, cfg.L2setsize, cfg.L2size}) {
+            ar.expect(value, "cache geometry");
+        }
+        ar(l1_cache);
+        ar(l2_cache);
     }
 
-    CacheSystem cache_sys(cacheconfig);
+    void enable_prefetcher(const Config& cfg) {
+        const bool l1 = cfg.prefetch_level == 1;
+        prefetcher.emplace(cfg.prefetcher, cfg.prefetch_level,
+                           cfg.prefetch_params, l1_cache.addr_sys.offset_size,
+                           (l1 ? cfg.L1size : cfg.L2size) * 1024 /
+                               (l1 ? cfg.L1blocksize : cfg.L2blocksize));
+    }
 
-    if (traces.is_open() && tracesout.is_open()) {
-        string line;
-        while (getline(traces,
-                       line)) {  // read mem access file and access Cache
+    template < typename Result >
+    void run_prefetcher(unsigned addr, const Result& result, bool used) {
+        const auto& [l1_ret, l2_ret, mem_ret] = result;
+        const int offset_size = l1_cache.addr_sys.offset_size;
+        const std::int64_t block = addr >> offset_size;
+        if (used) {
+            prefetcher->on_useful(block);
+        }
+        if (prefetcher->level == 2 && l2_ret == NA) {
+            // L1 hits never reach the L2 prefetcher
+            return;
+        }
+        const bool miss = prefetcher->level == 1
+                              ? (l1_ret == RM || l1_ret == WM)
+                              : (l2_ret == RM || l2_ret == WM);
+        for (const auto candidate : prefetcher->train(block, miss)) {
+            if (candidate < 0 || candidate > (0xffffffffL >> offset_size)) {
+                continue;
+            }
+            const auto candidate_addr =
+                static_cast< unsigned >(candidate << offset_size);
+            if (prefetch_fill(candidate_addr)) {
+                prefetcher->on_issued(candidate);
+            } else {
+                prefetcher->stats.redundant++;
+            }
+        }
+    }
 
-            string accesstype;
-            unsigned int addr;
-            bitset< 32 > access_addr;
-            string hex_addr;
+    bool prefetch_fill(unsigned addr) {
+        /*
+         * bring the block at `addr` into the prefetch level without counting
+         * it as a demand access
+         *
+         * return value: <bool> was a block filled ?
+         */
+        const int offset_size = l1_cache.addr_sys.offset_size;
+        const int l2_offset_size = l2_cache.addr_sys.offset_size;
+        if (l1_cache.contains(addr)) {
+            return false;
+        }
+        const auto& [l2_tag, l2_index, l2_offset] =
+            l2_cache.addr_sys.parse(addr);
+        auto& l2_set = l2_cache.sets[l2_index];
+        const auto l2_found = l2_set.search(l2_tag);
 
-            istringstream iss(line);
-            if (!(iss >> accesstype >> hex_addr)) {
-                break;
+        bool did_write_to_mem = false;
+        if (prefetcher->level == 1) {
+            // from L2 if it is there, otherwise from memory
+            CacheBlock block(0, true, false);
+            if (l2_found != l2_set.cend()) {
+                block = *l2_found;
+                l2_found->valid = false;
+                if (miss_classes) {
+                    miss_classes->l2.drop(addr >> l2_offset_size);
+                }
+            } else if (dram) {
+                dram->read(addr);
+            }
+            block.prefetched = true;
+            const bool l1_full =
+                l1_cache.sets[l1_cache.addr_sys.parse(addr).index].is_full();
+            did_write_to_mem = this->place_in_l1(addr, block);
+            if (l1_full) {
+                prefetcher->on_displaced(last_l1_victim >> offset_size);
+            }
+            if (miss_classes) {
+                miss_classes->l1.fill(addr >> offset_size);
+                if (l1_full) {
+                    miss_classes->l2.fill(last_l1_victim >> l2_offset_size);
+                }
+            }
+        } else {
+            if (l2_found != l2_set.cend()) {
+                return false;
+            }
+            if (dram) {
+                dram->read(addr);
             }
-            stringstream saddr(hex_addr);
-            saddr >> std::hex >> addr;
-            access_addr = bitset< 32 >(addr);
+            if (l2_set.is_full()) {
+                did_write_to_mem = this->l2_evict(addr);
+                prefetcher->on_displaced(last_l2_victim >> offset_size);
+            }
+            CacheBlock block(l2_tag, true, false);
+            block.prefetched = true;
+            l2_set.fill(l2_set.find_space(), block);
+            if (miss_classes) {
+                miss_classes->l2.fill(addr >> l2_offset_size);
+            }
+        }
+        if (did_write_to_mem) {
+            prefetcher->stats.writebacks++;
+        }
+        return true;
+    }
 
-            // access the L1 and L2 Cache according to the trace;
-            if (accesstype.compare("R") == 0) {
-                dout << debug::bg::blue << "R" << debug::reset << " "
-                     << hex_addr << " " << access_addr << endl;
+    void enable_miss_classification(const Config& cfg) {
+        miss_classes.emplace(MissClasses{
+            three_c::LevelClassifier(cfg.L1size * 1024 / cfg.L1blocksize,
+                                     l1_cache.sets.size()),
+            three_c::LevelClassifier(cfg.L2size * 1024 / cfg.L2blocksize,
+                                     l2_cache.sets.size())});
+    }
+
+    template < typename Result >
+    void classify(unsigned addr, const Result& result, bool l1_evicted) {
+        const auto& [l1_ret, l2_ret, mem_ret] = result;
+        const bool read = l1_ret == RH || l1_ret == RM;
+        const auto l1_addr = l1_cache.addr_sys.parse(addr);
+        miss_classes->l1.access(
+            addr >> l1_cache.addr_sys.offset_size, l1_addr.index,
+            l1_ret == RM || l1_ret == WM,
+            read ? three_c::LevelClassifier::allocate
+                 : three_c::LevelClassifier::bypass);
+        if (l2_ret != NA) {
+            // only L1 misses reach L2; a read moves the block up to L1
+            const auto l2_addr = l2_cache.addr_sys.parse(addr);
+            miss_classes->l2.access(
+                addr >> l2_cache.addr_sys.offset_size, l2_addr.index,
+                l2_ret == RM || l2_ret == WM,
+                read ? three_c::LevelClassifier::give_up
+                     : three_c::LevelClassifier::bypass);
+        }
+        if (l1_evicted) {
+            // the L1 victim is what fills the exclusive L2
+            miss_classes->l2.fill(last_l1_victim >>
+                                  l2_cache.addr_sys.offset_size);
+        }
+    }
+
+    struct MissClasses {
+        three_c::LevelClassifier l1;
+        three_c::LevelClassifier l2;
+    };
+
+    Cache< Policy, L1Address > l1_cache;
+    Cache< Policy, L2Address > l2_cache;
+    std::optional< MissClasses > miss_classes;  // --3c instrumentation
+    std::optional< prefetch::Engine > prefetcher;
+    std::optional< l2trace::Writer > l2_export;  // --export-l2
+    std::optional< dram::Controller > dram;
+    std::optional< mshr::Timing > timing;  // fed by the trace loop
+
+    // block addresses of the most recent evictions
+    unsigned last_l1_victim = 0;
+    unsigned last_l2_victim = 0;
+    bool last_l1_victim_dirty = false;
+    std::uint64_t l1_evictions = 0;
+};
+
+template < int BlockSize, int Ways, int SizeKiB >
+struct Geometry {
+    using address = FixedCacheAddress< BlockSize, Ways,
+                                       SizeKiB * 1024 / BlockSize / Ways >;
+
+    static bool matches(int block_size, int ways, int size) {
+        return block_size == BlockSize && ways == Ways && size == SizeKiB;
+    }
+};
+
+template < typename L1, typename L2 >
+struct HierarchyGeometry {
+    using l1 = typename L1::address;
+    using l2 = typename L2::address;
+
+    static bool matches(const Config& cfg) {
+        return L1::matches(cfg.L1blocksize, cfg.L1setsize, cfg.L1size) &&
+               L2::matches(cfg.L2blocksize, cfg.L2setsize, cfg.L2size);
+    }
+};
+
+struct RuntimeGeometry {
+    using l1 = CacheAddress;
+    using l2 = CacheAddress;
+};
+
+template < typename... Hierarchies >
+struct GeometryTable {};
+
+// pre-instantiated for every replacement policy, keep this list short
+using common_geometries = GeometryTable<
+    // cacheconfig.txt
+    HierarchyGeometry< Geometry< 8, 1, 16 >, Geometry< 8, 1, 32 > >,
+    // cacheconfig_set_associative.txt
+    HierarchyGeometry< Geometry< 4, 2, 16 >, Geometry< 4, 4, 32 > >,
+    // 32 KiB 8-way L1 / 256 KiB 8-way L2 with 64 B lines
+    HierarchyGeometry< Geometry< 64, 8, 32 >, Geometry< 64, 8, 256 > > >;
+
+template < typename F >
+auto with_geometry(const Config&, F&& f, GeometryTable<>) {
+    return f(replacement::type_tag< RuntimeGeometry >{});
+}
+
+template < typename F, typename First, typename... Rest >
+auto with_geometry(const Config& cfg, F&& f, GeometryTable< First, Rest... >) {
+    /*
+     * calls f(type_tag< Hierarchy >{}) with the first table entry matching
+     * cfg, or with the runtime geometry if none does
+     */
+    if (First::matches(cfg)) {
+        return f(replacement::type_tag< First >{});
+    }
+    return with_geometry(cfg, std::forward< F >(f), GeometryTable< Rest... >{});
+}
 
-                const auto& [l1_ret, l2_ret, mem_ret] = cache_sys.read(addr);
-                // Output hit/miss results for L1 and L2 to the output file;
-                tracesout << l1_ret << " " << l2_ret << " " << mem_ret << endl;
+struct Options {
+    /*
+     * optional flags after <config> <trace>
+     *   --mrc                  estimate the miss ratio curve by sampling
+     *   --mrc-rate=<R>         initial sampling rate, (0, 1]
+     *   --mrc-max-blocks=<N>   tracked blocks before the rate is lowered
+     *   --threads[=<N>]        split the sets across N threads (default: all
+     *                          cores) when the hierarchy allows it
+     *   --3c                   classify misses as compulsory/capacity/conflict
+     *                          and write <trace>.summary
+     *   --coherence            multi-core MESI simulation, see run_coherent
+     *   --quantum=<N>          how many trace positions a core may run ahead
+     *                          of a core stalled on the bus (default 1, the
+     *                          exact trace order; larger is faster but only
+     *                          approximates the coherence counts)
+     *   --export-l2=<file>     also write the L1-filtered trace (l2trace.h)
+     *   --replay-l2            <trace> is an L1-filtered trace, simulate L2
+     *                          only
+     *   --load-snapshot=<file> start from the cache state in <file>
+     *   --save-snapshot=<file> write the cache state at the end of the run
+     *   --timeseries=<file>    per-window rates and phases (timeseries.h),
+     *                          binary if <file> ends in .bin, CSV otherwise
+     *   --window=<N>           accesses per time series window
+     *   --phase-threshold=<D>  signature distance that starts a new phase
+     */
+    bool mrc = false;
+    double mrc_rate = 0.01;
+    std::size_t mrc_max_blocks = 8192;
+    unsigned threads = 1;
+    bool three_c = false;
+    bool coherence = false;
+    std::uint64_t quantum = 1;
+    string export_l2;
+    bool replay_l2 = false;
+    string load_snapshot;
+    string save_snapshot;
+    string timeseries;
+    std::uint64_t window = 10000;
+    double phase_threshold = 0.5;
+
+    Options(int argc, char* argv[]) {
+        for (int i = 3; i < argc; i++) {
+            const string arg = argv[i];
+            const auto eq = arg.find('=');
+            const string key = arg.substr(0, eq);
+            const string value = eq == string::npos ? "" : arg.substr(eq + 1);
+
+            if (key == "--mrc") {
+                mrc = true;
+            } else if (key == "--mrc-rate") {
+                mrc = true;
+                mrc_rate = std::stod(value);
+            } else if (key == "--mrc-max-blocks") {
+                mrc = true;
+                mrc_max_blocks = std::stoul(value);
+            } else if (key == "--3c") {
+                three_c = true;
+            } else if (key == "--coherence") {
+                coherence = true;
+            } else if (key == "--quantum") {
+                quantum = std::max(std::stoull(value), 1ULL);
+            } else if (key == "--export-l2") {
+                export_l2 = value;
+            } else if (key == "--replay-l2") {
+                replay_l2 = true;
+            } else if (key == "--load-snapshot") {
+                load_snapshot = value;
+            } else if (key == "--save-snapshot") {
+                save_snapshot = value;
+            } else if (key == "--timeseries") {
+                timeseries = value;
+            } else if (key == "--window") {
+                window = std::stoull(value);
+            } else if (key == "--phase-threshold") {
+                phase_threshold = std::stod(value);
+            } else if (key == "--threads") {
+                threads = value.empty() ? std::thread::hardware_concurrency()
+                                        : std::stoul(value);
+                threads = std::max(threads, 1U);
             } else {
-                dout << debug::bg::red << "W" << debug::reset << " " << hex_addr
-                     << " " << access_addr << endl;
+                throw std::invalid_argument("unknown option: " + arg);
+            }
+        }
+    }
+};
+
+using access_stream::parse_access;
+
+class TraceInput {
+    /*
+     * the trace named on the command line: a file, a FIFO or "-" for stdin,
+     * text or binary (see access_stream.h)
+     *
+     * Pipes are drained by a reader thread into a bounded Channel, so the
+     * producer on the other end keeps running while an access is simulated
+     * instead of stalling on a full pipe buffer.
+     *
+     * The reader may be blocked on a pipe whose writer never writes or
+     * closes, which nothing can interrupt portably. So the stream and the
+     * channel are shared with the thread, and when the simulation ends (or
+     * fails) before the stream does, the thread is detached rather than
+     * joined: it finds the channel closed once the read returns, and dies
+     * with the process otherwise.
+     */
+   public:
+    explicit TraceInput(const string& name_)
+        : name(name_), input(std::make_shared< Input >()) {
+        std::istream* in = &cin;
+        if (name != "-") {
+            input->file.open(name, std::ios::binary);
+            in = &input->file;
+        }
+        if (!*in) {
+            return;
+        }
+        input->opened.emplace(*in);
+        struct stat info;
+        const bool piped = name == "-" || (stat(name.c_str(), &info) == 0 &&
+                                           S_ISFIFO(info.st_mode));
+        if (piped) {
+            reader = std::thread([shared = input] {
+                auto& in_source = shared->opened->source();
+                char accesstype;
+                unsigned addr;
+                while (in_source.next(accesstype, addr) &&
+                       shared->channel.push(accesstype, addr,
+                                            in_source.time)) {
+                }
+                shared->channel.close();
+                shared->drained = true;
+            });
+        }
+    }
 
-                const auto& [l1_ret, l2_ret, mem_ret] = cache_sys.write(addr);
-                // Output hit/miss results for L1 and L2 to the output file;
-                tracesout << l1_ret << " " << l2_ret << " " << mem_ret << endl;
+    ~TraceInput() {
+        if (reader.joinable()) {
+            input->channel.close();
+            if (input->drained) {
+                reader.join();
+            } else {
+                reader.detach();
             }
         }
-        traces.close();
-        tracesout.close();
-    } else
-        cout << "Unable to open trace or traceout file ";
+    }
+
+    bool is_open() const { return input->opened.has_value(); }
+
+    access_stream::Source& source() {
+        return reader.joinable() ? input->channel : input->opened->source();
+    }
+
+    // <trace>.out, <trace>.summary, ... are named after this
+    string output_base() const { return name == "-" ? "stdin" : name; }
+
+    bool next(char& accesstype, unsigned& addr) {
+        return source().next(accesstype, addr);
+    }
+
+    std::optional< std::uint64_t > time() { return source().time; }
+
+   private:
+    struct Input {
+        ifstream file;
+        std::optional< access_stream::Opened > opened;
+        access_stream::Channel channel;
+        std::atomic< bool > drained = false;  // the reader is done
+    };
+
+    string name;
+    std::shared_ptr< Input > input;  // shared with the reader thread
+    std::thread reader;
+};
+
+int run_mrc(const Config& cfg, const Options& opts, const string& tracename) {
+    /*
+     * One pass over the trace in constant memory, reporting the estimated
+     * fully-associative LRU miss ratio over a range of capacities
+     */
+    TraceInput traces(tracename);
+    if (!traces.is_open()) {
+        cout << "Unable to open trace file ";
+        return 1;
+    }
 
+    mrc::ShardsSampler sampler(cfg.L1blocksize, opts.mrc_rate,
+                               opts.mrc_max_blocks);
+    char accesstype;
+    unsigned addr;
+    while (traces.next(accesstype, addr)) {
+        sampler.access(addr);
+    }
+
+    const auto print_row = [&sampler](const string& label,
+                                      std::uint64_t blocks,
+                                      unsigned block_size) {
+        cout << setw(10) << label << setw(12) << blocks << setw(12)
+             << blocks * block_size << fixed << setprecision(4) << setw(12)
+             << sampler.miss_ratio(blocks) << "  +/- "
+             << sampler.error_bound(blocks) << endl;
+        cout.copyfmt(oldCoutState);
+    };
+
+    cout << "MRC (fully-associative LRU, " << cfg.L1blocksize
+         << " B blocks, spatially hashed sampling)" << endl;
+    cout << "accesses " << sampler.accesses() << ", sampled "
+         << sampler.sampled() << ", tracked blocks "
+         << sampler.tracked_blocks() << ", final rate " << sampler.rate()
+         << endl;
+    cout << setw(10) << "" << setw(12) << "blocks" << setw(12) << "bytes"
+         << setw(12) << "miss ratio" << endl;
+    const std::uint64_t block_bytes = cfg.L1blocksize;
+    const std::uint64_t l1_blocks = cfg.L1size * 1024UL / block_bytes;
+    const std::uint64_t l2_blocks = cfg.L2size * 1024UL / cfg.L2blocksize;
+    const std::uint64_t last = std::max(
+        {sampler.max_distance() * 2, l1_blocks + l2_blocks, std::uint64_t{1}});
+    for (std::uint64_t blocks = 1; blocks <= last; blocks *= 2) {
+        print_row("", blocks, block_bytes);
+    }
+    print_row("L1", l1_blocks, block_bytes);
+    print_row("L2", l2_blocks, block_bytes);
+    print_row("L1+L2", l1_blocks + l2_blocks, block_bytes);
     return 0;
 }
+
+template < typename Policy, std::size_t N >
+class CacheHierarchy {
+    /*
+     * N cache levels built from LevelConfig descriptors, level 0 is L1.
+     *
+     * Inclusion is the relation of a level to the level above it:
+     *   - inclusive: filled on every miss path, evicting a block also
+     *     invalidates it in all levels above (a dirty upper copy makes the
+     *     victim dirty)
+     *   - nine: filled on every miss path, no back-invalidation
+     *   - exclusive: never filled on a miss path, only holds victims of the
+     *     level above; a hit moves the block up (with its dirty bit)
+     * Write policies per level:
+     *   - write-back: a write hit marks the block dirty, dirty victims are
+     *     written to the next level (memory after the last one)
+     *   - write-through: a write hit is passed on to the next level
+     *   - write-allocate: a write miss fetches the block like a read and
+     *     then writes it, otherwise the write is passed on
+     *
+     * With L1 write-back/no-allocate and an exclusive write-back/no-allocate
+     * L2 this reproduces CacheSystem.
+     *
+     * N is a template parameter so the per-level loops have a fixed trip
+     * count, main instantiates one hierarchy per supported depth.
+     */
+   public:
+    struct Level {
+        Cache< Policy > cache;
+        inclusion incl;
+        bool write_back;
+        bool write_allocate;
+        int block_size;
+
+        auto find(unsigned addr) {
+            const auto& [tag, index, offset] = cache.addr_sys.parse(addr);
+            auto& set = cache.sets[index];
+            return std::make_pair(std::ref(set), set.search(tag));
+        }
+    };
+
+    struct Result {
+        std::array< int, N > levels;  // RH/RM/WH/WM/NA per level
+        int mem = NOWRITEMEM;
+    };
+
+    struct Stats {
+        std::array< std::uint64_t, N > hits = {};
+        std::array< std::uint64_t, N > misses = {};
+        std::array< std::uint64_t, N > back_invalidations = {};
+        std::uint64_t mem_reads = 0;
+        std::uint64_t mem_writes = 0;
+    };
+
+    explicit CacheHierarchy(const Config& cfg)
+        : levels(make_levels(cfg, std::make_index_sequence< N >{})) {}
+
+    Result read(unsigned addr) {
+        result = Result{};
+        result.levels.fill(NA);
+        auto [set, found] = levels[0].find(addr);
+        if (found != set.cend()) {
+            set.touch(found);
+            record(0, RH);
+        } else {
+            record(0, RM);
+            fetch(addr, 0, false);
+        }
+        return result;
+    }
+
+    Result write(unsigned addr) {
+        result = Result{};
+        result.levels.fill(NA);
+        write_from(addr, 0);
+        return result;
+    }
+
+    auto access(char accesstype, unsigned addr) {
+        return accesstype == 'R' ? read(addr) : write(addr);
+    }
+
+    void report(std::ostream& out) const {
+        for (std::size_t i = 0; i < N; i++) {
+            out << "L" << i + 1 << ": " << stats.hits[i] << " hits, "
+                << stats.misses[i] << " misses, "
+                << stats.back_invalidations[i] << " back-invalidations\n";
+        }
+        out << "memory: " << stats.mem_reads << " block reads, "
+            << stats.mem_writes << " writes\n";
+    }
+
+    std::array< Level, N > levels;
+    Stats stats;
+
+   private:
+    template < std::size_t... I >
+    static std::array< Level, N > make_levels(const Config& cfg,
+                                              std::index_sequence< I... >) {
+        return {make_level(cfg.levels.at(I), I)...};
+    }
+
+    static Level make_level(const LevelConfig& lc, std::size_t i) {
+        return Level{
+            Cache< Policy >(lc.blocksize, lc.setsize, lc.size,
+                            CacheAddress(i + 1, lc.blocksize, lc.setsize,
+                                         lc.size)),
+            lc.incl, lc.write_back, lc.write_allocate, lc.blocksize};
+    }
+
+    void record(std::size_t level, int code) {
+        result.levels[level] = code;
+        if (code == RH || code == WH) {
+            stats.hits[level]++;
+        } else {
+            stats.misses[level]++;
+        }
+    }
+
+    void fetch(unsigned addr, std::size_t top, bool is_write) {
+        /*
+         * `top` missed, look further down and fill the block into `top` and
+         * into the non-exclusive levels in between
+         */
+        const int hit_code = is_write ? WH : RH;
+        const int miss_code = is_write ? WM : RM;
+        std::size_t k = top + 1;
+        bool dirty = false;
+        for (; k < N; k++) {
+            auto [set, found] = levels[k].find(addr);
+            if (found != set.cend()) {
+                record(k, hit_code);
+                if (levels[k].incl == inclusion::exclusive) {
+                    // move up, the dirty data goes along
+                    dirty = found->dirty;
+                    found->valid = false;
+                } else {
+                    set.touch(found);
+                }
+                break;
+            }
+            record(k, miss_code);
+        }
+        if (k == N) {
+            stats.mem_reads++;
+        }
+        for (std::size_t j = k; j-- > top;) {
+            if (j != top && levels[j].incl == inclusion::exclusive) {
+                continue;
+            }
+            insert(j, addr, dirty);
+            dirty = false;  // the nearest copy owns the dirty data
+        }
+    }
+
+    void write_from(unsigned addr, std::size_t i) {
+        // a write (from the CPU or written through) arrives at level i
+        for (; i < N; i++) {
+            auto& level = levels[i];
+            auto [set, found] = level.find(addr);
+            if (found != set.cend()) {
+                record(i, WH);
+                set.touch(found);
+                if (level.write_back) {
+                    found->dirty = true;
+                    return;
+                }
+                continue;  // write-through
+            }
+            record(i, WM);
+            if (level.write_allocate) {
+                fetch(addr, i, true);
+                if (level.write_back) {
+                    auto [new_set, filled] = level.find(addr);
+                    filled->dirty = true;
+                    return;
+                }
+            }
+        }
+        mem_write();
+    }
+
+    void insert(std::size_t j, unsigned addr, bool dirty) {
+        auto& level = levels[j];
+        const auto& [tag, index, offset] = level.cache.addr_sys.parse(addr);
+        auto& set = level.cache.sets[index];
+        if (set.search(tag) != set.cend()) {
+            return;
+        }
+        if (set.is_full()) {
+            auto& victim = set[set.evict_who()];
+            const unsigned victim_addr =
+                level.cache.addr_sys.block_addr(victim.tag, index);
+            const bool victim_dirty = victim.dirty;
+            victim.valid = false;
+            evicted(j, victim_addr, victim_dirty);
+        }
+        set.fill(set.find_space(), CacheBlock(tag, true, dirty));
+    }
+
+    void evicted(std::size_t j, unsigned addr, bool dirty) {
+        if (levels[j].incl == inclusion::inclusive) {
+            dirty = back_invalidate(j, addr) || dirty;
+        }
+        if (j + 1 < N && levels[j + 1].incl == inclusion::exclusive) {
+            insert(j + 1, addr, dirty);  // victim cache below
+        } else if (dirty) {
+            write_back(j + 1, addr);
+        }
+    }
+
+    bool back_invalidate(std::size_t j, unsigned addr) {
+        // drop every copy of level j's block from the levels above it
+        // return value: <bool> was any of them dirty ?
+        bool dirty = false;
+        const unsigned size = levels[j].block_size;
+        for (std::size_t u = 0; u < j; u++) {
+            const unsigned step = std::min< unsigned >(levels[u].block_size,
+                                                       size);
+            for (unsigned a = addr; a - addr < size; a += step) {
+                auto [set, found] = levels[u].find(a);
+                if (found != set.cend()) {
+                    dirty = dirty || found->dirty;
+                    found->valid = false;
+                    stats.back_invalidations[j]++;
+                }
+            }
+        }
+        return dirty;
+    }
+
+    void write_back(std::size_t j, unsigned addr) {
+        // dirty data of a block evicted from level j - 1
+        for (; j < N; j++) {
+            auto& level = levels[j];
+            auto [set, found] = level.find(addr);
+            if (found != set.cend()) {
+                if (level.write_back) {
+                    found->dirty = true;
+                    return;
+                }
+                continue;
+            }
+            if (level.write_back) {
+                insert(j, addr, true);
+                return;
+            }
+        }
+        mem_write();
+    }
+
+    void mem_write() {
+        result.mem = WRITEMEM;
+        stats.mem_writes++;
+    }
+
+    Result result;
+};
+
+template < typename Policy, std::size_t N >
+int run_hierarchy(const Config& cacheconfig, const string& tracename) {
+    TraceInput traces(tracename);
+    ofstream tracesout(traces.output_base() + ".out");
+    if (!traces.is_open() || !tracesout.is_open()) {
+        cout << "Unable to open trace or traceout file ";
+        return 0;
+    }
+
+    CacheHierarchy< Policy, N > hierarchy(cacheconfig);
+    char accesstype;
+    unsigned addr;
+    while (traces.next(accesstype, addr)) {
+        const auto result = hierarchy.access(accesstype, addr);
+        // one hit/miss code per level, then the memory write flag
+        for (const auto code : result.levels) {
+            tracesout << code << " ";
+        }
+        tracesout << result.mem << '\n';
+    }
+    hierarchy.report(cout);
+    return 0;
+}
+
+constexpr std::size_t max_levels = 4;
+
+template < typename Policy, std::size_t N = 1 >
+int dispatch_depth(const Config& cacheconfig, const string& tracename) {
+    if (cacheconfig.levels.size() == N) {
+        return run_hierarchy< Policy, N >(cacheconfig, tracename);
+    }
+    if constexpr (N < max_levels) {
+        return dispatch_depth< Policy, N + 1 >(cacheconfig, tracename);
+    }
+    throw std::invalid_argument("supported depths are 1 to " +
+                                std::to_string(max_levels) + " levels");
+}
+
+Config read_config(const string& filename) {
+    /*
+     * "L<n>:" followed by block size, associativity and size in KiB starts a
+     * level; inclusion:, write: and allocate: lines after it set that
+     * level's policies
+     */
+    Config cacheconfig;
+    ifstream cache_params;
+    string token;
+    cache_params.open(filename);
+    auto& levels = cacheconfig.levels;
+    std::vector< bool > inclusion_given;  // by level
+    const auto current_level = [&]() -> LevelConfig& {
+        if (levels.empty()) {
+            throw std::invalid_argument(token + " before the first level");
+        }
+        cacheconfig.extended = true;
+        return levels.back();
+    };
+    while (cache_params >> token) {
+        // read config file
+        if (token == "policy:") {
+            cache_params >> cacheconfig.policy;  // replacement policy
+        } else if (token == "prefetcher:") {
+            cache_params >> cacheconfig.prefetcher;
+        } else if (token == "prefetch_level:") {
+            cache_params >> cacheconfig.prefetch_level;
+        } else if (token == "prefetch_degree:") {
+            cache_params >> cacheconfig.prefetch_params.degree;
+        } else if (token == "prefetch_distance:") {
+            cache_params >> cacheconfig.prefetch_params.distance;
+        } else if (token.rfind("dram", 0) == 0 || token == "tRCD:" ||
+                   token == "tCAS:" || token == "tRP:") {
+            if (!cacheconfig.dram) {
+                cacheconfig.dram.emplace();
+            }
+            auto& dram = *cacheconfig.dram;
+            if (token == "dram_channels:") {
+                cache_params >> dram.channels;
+            } else if (token == "dram_banks:") {
+                cache_params >> dram.banks;
+            } else if (token == "dram_row_bytes:") {
+                cache_params >> dram.row_bytes;
+            } else if (token == "dram_page:") {
+                string value;  // open / closed
+                cache_params >> value;
+                dram.open_page = value == "open";
+            } else if (token == "dram_burst:") {
+                cache_params >> dram.burst;
+            } else if (token == "dram_interval:") {
+                cache_params >> dram.interval;
+            } else if (token == "tRCD:") {
+                cache_params >> dram.tRCD;
+            } else if (token == "tCAS:") {
+                cache_params >> dram.tCAS;
+            } else if (token == "tRP:") {
+                cache_params >> dram.tRP;
+            } else if (token != "dram:") {  // "dram: on" keeps the defaults
+                throw std::invalid_argument("unknown config entry: " + token);
+            } else {
+                cache_params >> token;
+            }
+        } else if (token.rfind("mshr", 0) == 0 ||
+                   token.rfind("latency_", 0) == 0) {
+            if (!cacheconfig.mshr) {
+                cacheconfig.mshr.emplace();
+            }
+            auto& mshr = *cacheconfig.mshr;
+            if (token == "mshrs_l1:") {
+                cache_params >> mshr.l1_mshrs;
+            } else if (token == "mshrs_l2:") {
+                cache_params >> mshr.l2_mshrs;
+            } else if (token == "latency_l1:") {
+                cache_params >> mshr.l1_latency;
+            } else if (token == "latency_l2:") {
+                cache_params >> mshr.l2_latency;
+            } else if (token == "latency_mem:") {
+                cache_params >> mshr.mem_latency;
+            } else if (token == "mshr_interval:") {
+                cache_params >> mshr.interval;
+            } else if (token != "mshr:") {  // "mshr: on" keeps the defaults
+                throw std::invalid_argument("unknown config entry: " + token);
+            } else {
+                cache_params >> token;
+            }
+        } else if (token == "inclusion:") {
+            string value;
+            cache_params >> value;
+            auto& level = current_level();
+            inclusion_given.resize(levels.size());
+            inclusion_given.back() = true;
+            if (value == "inclusive") {
+                level.incl = inclusion::inclusive;
+            } else if (value == "exclusive") {
+                level.incl = inclusion::exclusive;
+            } else if (value == "nine") {
+                level.incl = inclusion::nine;
+            } else {
+                throw std::invalid_argument("unknown inclusion: " + value);
+            }
+        } else if (token == "write:") {
+            string value;  // back / through
+            cache_params >> value;
+            current_level().write_back = value == "back";
+        } else if (token == "allocate:") {
+            string value;  // yes / no
+            cache_params >> value;
+            current_level().write_allocate = value == "yes";
+        } else {  // L<n>:
+            LevelConfig level;
+            cache_params >> level.blocksize;  // Block size
+            cache_params >> level.setsize;    // Associativity
+            cache_params >> level.size;       // Cache Size
+            if (!cache_params) {
+                throw std::invalid_argument("unknown config entry: " + token);
+            }
+            levels.push_back(level);
+        }
+    }
+
+    if (levels.size() < 2) {
+        throw std::invalid_argument("need at least two cache levels");
+    }
+    cacheconfig.L1blocksize = levels[0].blocksize;
+    cacheconfig.L1setsize = levels[0].setsize;
+    cacheconfig.L1size = levels[0].size;
+    cacheconfig.L2blocksize = levels[1].blocksize;
+    cacheconfig.L2setsize = levels[1].setsize;
+    cacheconfig.L2size = levels[1].size;
+    for (std::size_t i = 1; i < levels.size(); i++) {
+        if (levels[i].incl != inclusion::exclusive ||
+            levels[i].blocksize == levels[i - 1].blocksize) {
+            continue;
+        }
+        if (i < inclusion_given.size() && inclusion_given[i]) {
+            throw std::invalid_argument(
+                "an exclusive level needs the block size of the level above");
+        }
+        levels[i].incl = inclusion::nine;
+    }
+    return cacheconfig;
+}
+
+unsigned partition_count(const Config& cfg, unsigned threads) {
+    /*
+     * Accesses to different L1 sets never interact in L1. A block evicted
+     * from L1 set i lands in the L2 set whose low index bits are i, so when
+     * the L2 index bits cover the L1 index bits (same block size, at least
+     * as many L2 sets) the low L1 index bits split the whole hierarchy into
+     * independent partitions.
+     *
+     * returns the number of partitions to use, 1 if the config can't be split
+     */
+    const long l1_sets = cfg.L1size * 1024L / cfg.L1blocksize / cfg.L1setsize;
+    const long l2_sets = cfg.L2size * 1024L / cfg.L2blocksize / cfg.L2setsize;
+    const bool pow2 = (l1_sets & (l1_sets - 1)) == 0 &&
+                      (l2_sets & (l2_sets - 1)) == 0;
+    if (cfg.L1blocksize != cfg.L2blocksize || !pow2 || l2_sets < l1_sets) {
+        return 1;
+    }
+    unsigned partitions = 1;
+    while (partitions * 2 <= threads && partitions * 2 <= l1_sets) {
+        partitions *= 2;
+    }
+    return partitions;
+}
+
+struct AccessResult {
+    std::uint8_t l1;
+    std::uint8_t l2;
+    std::uint8_t mem;
+};
+
+template < typename Policy, typename Hierarchy >
+int run_partitioned(const Config& cacheconfig, const string& tracename,
+                    unsigned partitions, const string& snapshot) {
+    /*
+     * The trace is read in chunks; every thread owns one partition of the
+     * sets and its own CacheSystem, simulates the accesses of its partition
+     * in trace order, and stores the results by trace position so they are
+     * written back in the original order.
+     *
+     * A warm-up snapshot is loaded into every partition's system, each one
+     * only ever touches its own sets of it.
+     */
+    using System =
+        CacheSystem< Policy, typename Hierarchy::l1, typename Hierarchy::l2 >;
+    constexpr std::size_t chunk_size = 1 << 20;
+
+    TraceInput traces(tracename);
+    ofstream tracesout(traces.output_base() + ".out");
+    if (!traces.is_open() || !tracesout.is_open()) {
+        cout << "Unable to open trace or traceout file ";
+        return 0;
+    }
+
+    const int offset_size = ceil_log2(cacheconfig.L1blocksize);
+    const unsigned partition_mask = partitions - 1;
+    std::vector< System > systems;
+    systems.reserve(partitions);
+    for (unsigned partition = 0; partition < partitions; partition++) {
+        systems.emplace_back(cacheconfig);
+        if (!snapshot.empty()) {
+            systems.back().load_snapshot(snapshot, cacheconfig);
+        }
+    }
+    std::vector< unsigned > addrs;
+    std::vector< char > types;
+    std::vector< AccessResult > results;
+    // trace positions in the chunk, by partition
+    std::vector< std::vector< std::uint32_t > > positions(partitions);
+    addrs.reserve(chunk_size);
+    types.reserve(chunk_size);
+
+    bool done = false;
+    while (!done) {
+        addrs.clear();
+        types.clear();
+        for (auto& p : positions) {
+            p.clear();
+        }
+        char accesstype;
+        unsigned addr;
+        while (addrs.size() < chunk_size) {
+            if (!traces.next(accesstype, addr)) {
+                done = true;
+                break;
+            }
+            positions[(addr >> offset_size) & partition_mask].push_back(
+                addrs.size());
+            addrs.push_back(addr);
+            types.push_back(accesstype);
+        }
+        results.resize(addrs.size());
+
+        const auto simulate = [&](unsigned partition) {
+            auto& cache_sys = systems[partition];
+            for (const auto i : positions[partition]) {
+                const auto& [l1_ret, l2_ret, mem_ret] =
+                    cache_sys.access(types[i], addrs[i]);
+                results[i] = {static_cast< std::uint8_t >(l1_ret),
+                              static_cast< std::uint8_t >(l2_ret),
+                              static_cast< std::uint8_t >(mem_ret)};
+            }
+        };
+        std::vector< std::thread > workers;
+        for (unsigned partition = 1; partition < partitions; partition++) {
+            workers.emplace_back(simulate, partition);
+        }
+        simulate(0);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        for (const auto& r : results) {
+            tracesout << int(r.l1) << " " << int(r.l2) << " " << int(r.mem)
+                      << '\n';
+        }
+    }
+    return 0;
+}
+
+template < typename Policy >
+class MultiCoreSystem {
+    /*
+     * private L1 per core (levels[0]) kept coherent by MESI over a snooping
+     * bus, shared write-back L2 (levels[1]) that is neither inclusive nor
+     * exclusive; writes allocate, since a core needs ownership to write
+     *
+     * Each core runs on its own host thread in phases:
+     *   1. every core consumes its accesses that stay inside its own L1
+     *      (read hits, write hits on modified/exclusive lines), up to a
+     *      horizon of `quantum` trace positions past the oldest pending
+     *      access
+     *   2. the cores stalled on a bus transaction are served one at a time
+     *      in trace order, on the main thread
+     * so a core can run ahead of a stalled one by at most the quantum.
+     * Its local hits can then come before an earlier access of another core
+     * that would have invalidated the line, so only a quantum of 1 keeps the
+     * trace order and gives exact coherence counts. That one runs on a
+     * single thread (run_in_order): the threads only pay off with a larger,
+     * approximate, quantum.
+     */
+   public:
+    struct Core {
+        Cache< Policy > l1;
+        std::vector< coherence::Line > lines;  // per block, set-major
+        std::vector< coherence::Access > trace;
+        std::size_t next = 0;  // first access not simulated yet
+        coherence::CoreStats stats;
+    };
+
+    MultiCoreSystem(const Config& cfg, int n_cores)
+        : ways(cfg.L1setsize),
+          l2(cfg.L2blocksize, cfg.L2setsize, cfg.L2size,
+             CacheAddress(2, cfg.L2blocksize, cfg.L2setsize, cfg.L2size)) {
+        if (cfg.needs_hierarchy()) {
+            throw std::invalid_argument(
+                "coherence needs a plain two-level config with one block size");
+        }
+        for (int c = 0; c < n_cores; c++) {
+            Cache< Policy > l1(cfg.L1blocksize, cfg.L1setsize, cfg.L1size,
+                               CacheAddress(1, cfg.L1blocksize,
+                                            cfg.L1setsize, cfg.L1size));
+            const std::size_t n_lines = l1.sets.size() * ways;
+            cores.push_back(Core{std::move(l1),
+                                 std::vector< coherence::Line >(n_lines),
+                                 {}, 0, {}});
+        }
+    }
+
+    void run(std::vector< AccessResult >& results, std::uint64_t quantum_) {
+        quantum = quantum_;
+        if (quantum == 1) {
+            run_in_order(results);
+            return;
+        }
+        const unsigned n = cores.size();
+        coherence::Barrier barrier(n + 1);
+        std::uint64_t horizon = 0;
+        bool finished = false;
+
+        const auto local_phase = [&](unsigned c) {
+            auto& core = cores[c];
+            while (core.next < core.trace.size() &&
+                   core.trace[core.next].pos < horizon &&
+                   local_access(core, core.trace[core.next], results)) {
+                core.next++;
+            }
+        };
+        std::vector< std::thread > threads;
+        for (unsigned c = 0; c < n; c++) {
+            threads.emplace_back([&, c] {
+                while (true) {
+                    barrier.arrive_and_wait();  // horizon is set
+                    if (finished) {
+                        return;
+                    }
+                    local_phase(c);
+                    barrier.arrive_and_wait();  // hand over to the bus
+                }
+            });
+        }
+
+        std::vector< unsigned > stalled;
+        while (true) {
+            std::uint64_t oldest = UINT64_MAX;
+            for (const auto& core : cores) {
+                if (core.next < core.trace.size()) {
+                    oldest = std::min(oldest, core.trace[core.next].pos);
+                }
+            }
+            if (oldest == UINT64_MAX) {
+                break;
+            }
+            horizon = oldest + quantum;
+            barrier.arrive_and_wait();
+            barrier.arrive_and_wait();
+
+            // ordered arbitration at the shared level
+            stalled.clear();
+            for (unsigned c = 0; c < n; c++) {
+                const auto& core = cores[c];
+                if (core.next < core.trace.size() &&
+                    core.trace[core.next].pos < horizon) {
+                    stalled.push_back(c);
+                }
+            }
+            std::sort(stalled.begin(), stalled.end(),
+                      [&](unsigned a, unsigned b) {
+                          return cores[a].trace[cores[a].next].pos <
+                                 cores[b].trace[cores[b].next].pos;
+                      });
+            for (const auto c : stalled) {
+                auto& core = cores[c];
+                bus_access(c, core.trace[core.next], results);
+                core.next++;
+            }
+        }
+        finished = true;
+        barrier.arrive_and_wait();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    void report(std::ostream& out) const {
+        out << "quantum " << quantum
+            << (quantum == 1 ? " (exact trace order)\n"
+                             : " (approximate coherence counts)\n");
+        for (std::size_t c = 0; c < cores.size(); c++) {
+            cores[c].stats.report(out, c);
+        }
+        bus.report(out);
+    }
+
+    std::vector< Core > cores;
+
+   private:
+    using mesi = coherence::mesi;
+
+    // the L1 block holding addr and its coherence state, nullptr if absent
+    std::pair< CacheBlock*, coherence::Line* > lookup(Core& core,
+                                                      unsigned addr) {
+        const auto& [tag, index, offset] = core.l1.addr_sys.parse(addr);
+        auto& set = core.l1.sets[index];
+        const auto found = set.search(tag);
+        if (found == set.cend()) {
+            return {nullptr, nullptr};
+        }
+        const std::size_t way = found - set.blocks.begin();
+        set.touch(found);
+        return {&*found, &core.lines[index * ways + way]};
+    }
+
+    std::uint64_t word_of(const Core& core, unsigned addr) const {
+        const auto& addr_sys = core.l1.addr_sys;
+        return coherence::word_bit(addr & bitmask(addr_sys.offset_size),
+                                   addr_sys.offset_size);
+    }
+
+    void run_in_order(std::vector< AccessResult >& results) {
+        /*
+         * a quantum of 1 leaves no core anything to run ahead with, so the
+         * phases would only add two barrier rounds per access: every access
+         * is simulated on this thread, in trace order
+         */
+        while (true) {
+            Core* next = nullptr;
+            unsigned c = 0;
+            for (unsigned k = 0; k < cores.size(); k++) {
+                auto& core = cores[k];
+                if (core.next < core.trace.size() &&
+                    (next == nullptr ||
+                     core.trace[core.next].pos < next->trace[next->next].pos)) {
+                    next = &core;
+                    c = k;
+                }
+            }
+            if (next == nullptr) {
+                return;
+            }
+            const auto& a = next->trace[next->next];
+            if (!local_access(*next, a, results)) {
+                bus_access(c, a, results);
+            }
+            next->next++;
+        }
+    }
+
+    bool local_access(Core& core, const coherence::Access& a,
+                      std::vector< AccessResult >& results) {
+        // returns false when the access needs the bus
+        const auto [block, line] = lookup(core, a.addr);
+        if (block == nullptr) {
+            return false;
+        }
+        if (a.type == 'R') {
+            core.stats.reads++;
+            core.stats.read_hits++;
+            results[a.pos] = {RH, NA, NOWRITEMEM};
+            return true;
+        }
+        if (line->state == mesi::shared) {
+            return false;
+        }
+        core.stats.writes++;
+        core.stats.write_hits++;
+        line->state = mesi::modified;
+        line->written |= word_of(core, a.addr);
+        block->dirty = true;
+        results[a.pos] = {WH, NA, NOWRITEMEM};
+        return true;
+    }
+
+    void bus_access(unsigned c, const coherence::Access& a,
+                    std::vector< AccessResult >& results) {
+        auto& core = cores[c];
+        const bool is_write = a.type != 'R';
+        AccessResult result = {static_cast< std::uint8_t >(is_write ? WM : RM),
+                               NA, NOWRITEMEM};
+        bool mem_write = false;
+        (is_write ? core.stats.writes : core.stats.reads)++;
+
+        const auto [block, line] = lookup(core, a.addr);
+        if (block != nullptr) {
+            // write hit on a shared line
+            invalidate_others(c, a.addr);
+            core.stats.write_hits++;
+            core.stats.upgrades++;
+            bus.upgrades++;
+            line->state = mesi::modified;
+            line->written = word_of(core, a.addr);
+            block->dirty = true;
+            results[a.pos] = {WH, NA, NOWRITEMEM};
+            return;
+        }
+
+        // snoop the other L1s
+        bool shared = false;
+        bool supplied = false;
+        for (unsigned o = 0; o < cores.size(); o++) {
+            if (o == c) {
+                continue;
+            }
+            auto& other = cores[o];
+            const auto [o_block, o_line] = peek(other, a.addr);
+            if (o_block == nullptr) {
+                continue;
+            }
+            if (o_line->state == mesi::modified) {
+                supplied = true;
+                bus.transfers++;
+                if ((o_line->written & word_of(core, a.addr)) == 0) {
+                    bus.false_sharing++;
+                }
+                if (!is_write) {
+                    // flush, the requester reads a clean shared copy
+                    mem_write |= l2_install(a.addr, true);
+                }
+            }
+            if (is_write) {
+                o_block->valid = false;
+                o_block->dirty = false;
+                *o_line = coherence::Line{};
+                other.stats.invalidated++;
+                bus.invalidations++;
+            } else {
+                o_block->dirty = false;
+                o_line->state = mesi::shared;
+                o_line->written = 0;
+                shared = true;
+            }
+        }
+
+        if (!supplied && !shared) {
+            // from the L2, or memory through it
+            const bool l2_hit = l2.read(a.addr) == read_request::hit;
+            result.l2 = is_write ? (l2_hit ? WH : WM) : (l2_hit ? RH : RM);
+            if (l2_hit) {
+                bus.l2_hits++;
+            } else {
+                bus.l2_misses++;
+                mem_write |= l2_install(a.addr, false);
+            }
+        }
+
+        coherence::Line filled;
+        filled.state = is_write ? mesi::modified
+                       : shared ? mesi::shared
+                                : mesi::exclusive;
+        filled.written = is_write ? word_of(core, a.addr) : 0;
+        mem_write |= l1_fill(core, a.addr, filled);
+        result.mem = mem_write ? WRITEMEM : NOWRITEMEM;
+        results[a.pos] = result;
+    }
+
+    // like lookup, without updating the replacement state
+    std::pair< CacheBlock*, coherence::Line* > peek(Core& core,
+                                                    unsigned addr) {
+        const auto& [tag, index, offset] = core.l1.addr_sys.parse(addr);
+        auto& set = core.l1.sets[index];
+        const auto found = set.search(tag);
+        if (found == set.cend()) {
+            return {nullptr, nullptr};
+        }
+        const std::size_t way = found - set.blocks.begin();
+        return {&*found, &core.lines[index * ways + way]};
+    }
+
+    void invalidate_others(unsigned c, unsigned addr) {
+        for (unsigned o = 0; o < cores.size(); o++) {
+            if (o == c) {
+                continue;
+            }
+            const auto [block, line] = peek(cores[o], addr);
+            if (block != nullptr) {
+                block->valid = false;
+                *line = coherence::Line{};
+                cores[o].stats.invalidated++;
+                bus.invalidations++;
+            }
+        }
+    }
+
+    // return value: <bool> did the fill cause a memory write ?
+    bool l1_fill(Core& core, unsigned addr, const coherence::Line& state) {
+        const auto& [tag, index, offset] = core.l1.addr_sys.parse(addr);
+        auto& set = core.l1.sets[index];
+        bool mem_write = false;
+        if (set.is_full()) {
+            const int way = set.evict_who();
+            auto& victim = set[way];
+            if (victim.dirty) {
+                mem_write = l2_install(
+                    core.l1.addr_sys.block_addr(victim.tag, index), true);
+            }
+            victim.valid = false;
+            core.lines[index * ways + way] = coherence::Line{};
+        }
+        const auto spot = set.find_space();
+        set.fill(spot, CacheBlock(tag, true, state.state == mesi::modified));
+        core.lines[index * ways + (spot - set.blocks.begin())] = state;
+        return mem_write;
+    }
+
+    // return value: <bool> was a dirty L2 victim written to memory ?
+    bool l2_install(unsigned addr, bool dirty) {
+        const auto& [tag, index, offset] = l2.addr_sys.parse(addr);
+        auto& set = l2.sets[index];
+        const auto found = set.search(tag);
+        if (found != set.cend()) {
+            found->dirty = found->dirty || dirty;
+            return false;
+        }
+        bool mem_write = false;
+        if (set.is_full()) {
+            auto& victim = set[set.evict_who()];
+            mem_write = victim.dirty;
+            bus.mem_writes += victim.dirty;
+            victim.valid = false;
+        }
+        set.fill(set.find_space(), CacheBlock(tag, true, dirty));
+        return mem_write;
+    }
+
+    int ways;
+    Cache< Policy > l2;
+    coherence::BusStats bus;
+    std::uint64_t quantum = 1;  // of the last run
+};
+
+bool parse_core_access(const string& line, unsigned& core, char& accesstype,
+                       unsigned& addr) {
+    // "<core> <R|W> <hex address>"
+    char* end = nullptr;
+    const unsigned long id = std::strtoul(line.c_str(), &end, 10);
+    core = std::min(id, static_cast< unsigned long >(UINT_MAX));  // no wrap
+    return end != line.c_str() && parse_access(end, accesstype, addr);
+}
+
+constexpr unsigned max_cores = 64;
+
+template < typename Policy >
+int run_coherent(const Config& cacheconfig, const Options& opts,
+                 const string& tracenames) {
+    /*
+     * `tracenames` is either one trace with a core ID column, or a comma
+     * separated list of per-core traces interleaved one access at a time;
+     * results go to <trace>.out of the trace each access came from
+     *
+     * Every core gets its own L1 and thread, so there are at most max_cores
+     * of them; a larger core ID is taken for a typo and rejected.
+     */
+    std::vector< string > names;
+    std::stringstream list(tracenames);
+    for (string name; getline(list, name, ',');) {
+        names.push_back(name);
+    }
+    if (names.size() > max_cores) {
+        throw std::invalid_argument("more than " + std::to_string(max_cores) +
+                                    " core traces");
+    }
+    const bool core_column = names.size() == 1;
+
+    std::vector< std::vector< coherence::Access > > traces;
+    std::vector< std::vector< std::uint64_t > > positions(names.size());
+    std::uint64_t total = 0;
+    if (core_column) {
+        ifstream trace(names[0]);
+        if (!trace.is_open()) {
+            cout << "Unable to open trace or traceout file ";
+            return 0;
+        }
+        string line;
+        unsigned core;
+        char accesstype;
+        unsigned addr;
+        for (std::uint64_t line_no = 1; getline(trace, line) &&
+                                        parse_core_access(line, core,
+                                                          accesstype, addr);
+             line_no++) {
+            if (core >= max_cores) {
+                throw std::invalid_argument(
+                    names[0] + ":" + std::to_string(line_no) + ": core ID " +
+                    std::to_string(core) + " is not below " +
+                    std::to_string(max_cores) + ": " + line);
+            }
+            if (core >= traces.size()) {
+                traces.resize(core + 1);
+            }
+            traces[core].push_back({total, accesstype, addr});
+            positions[0].push_back(total++);
+        }
+    } else {
+        traces.resize(names.size());
+        std::vector< std::vector< std::pair< char, unsigned > > > streams;
+        for (const auto& name : names) {
+            ifstream trace(name);
+            if (!trace.is_open()) {
+                cout << "Unable to open trace or traceout file ";
+                return 0;
+            }
+            streams.emplace_back();
+            string line;
+            char accesstype;
+            unsigned addr;
+            while (getline(trace, line) &&
+                   parse_access(line, accesstype, addr)) {
+                streams.back().emplace_back(accesstype, addr);
+            }
+        }
+        // round-robin interleaving
+        for (std::size_t i = 0, live = streams.size(); live > 0; i++) {
+            live = 0;
+            for (std::size_t c = 0; c < streams.size(); c++) {
+                if (i < streams[c].size()) {
+                    live++;
+                    const auto& [accesstype, addr] = streams[c][i];
+                    traces[c].push_back({total, accesstype, addr});
+                    positions[c].push_back(total++);
+                }
+            }
+        }
+    }
+
+    MultiCoreSystem< Policy > system(cacheconfig, traces.size());
+    for (std::size_t c = 0; c < traces.size(); c++) {
+        system.cores[c].trace = std::move(traces[c]);
+    }
+    std::vector< AccessResult > results(total);
+    system.run(results, opts.quantum);
+
+    for (std::size_t t = 0; t < names.size(); t++) {
+        ofstream tracesout(names[t] + ".out");
+        for (const auto pos : positions[t]) {
+            const auto& r = results[pos];
+            tracesout << int(r.l1) << " " << int(r.l2) << " " << int(r.mem)
+                      << '\n';
+        }
+    }
+    system.report(cout);
+    return 0;
+}
+
+template < typename Policy >
+int run_replay_l2(const Config& cacheconfig, const string& tracename) {
+    /*
+     * L2 only, driven by an L1-filtered trace; <trace>.out gets a line per
+     * access that missed L1, the same lines a full run prints for them
+     */
+    l2trace::Reader reader(tracename);
+    const auto& header = reader.header;
+    if (static_cast< int >(header.block_size) != cacheconfig.L2blocksize) {
+        throw std::invalid_argument(
+            "the L2 block size must match the recorded L1 block size");
+    }
+    ofstream tracesout(tracename + ".out");
+    CacheSystem< Policy > cache_sys(cacheconfig);
+
+    std::array< std::uint64_t, WRITEMEM + 1 > counts = {};
+    std::uint64_t misses = 0;
+    std::uint64_t mem_writes = 0;
+    int l1_ret = NA;
+    int l2_ret = NA;
+    bool did_write_to_mem = false;
+    const auto flush = [&] {
+        if (l1_ret != NA) {
+            tracesout << l1_ret << " " << l2_ret << " "
+                      << (did_write_to_mem ? WRITEMEM : NOWRITEMEM) << '\n';
+            counts[l2_ret]++;
+            mem_writes += did_write_to_mem;
+        }
+    };
+    l2trace::Record record;
+    while (reader.next(record)) {
+        if (record.type == l2trace::read || record.type == l2trace::write) {
+            flush();
+            misses++;
+            l1_ret = record.type == l2trace::read ? RM : WM;
+            did_write_to_mem = false;
+        }
+        const auto [code, wrote] = cache_sys.replay(record);
+        if (code != NA) {
+            l2_ret = code;
+        }
+        did_write_to_mem = did_write_to_mem || wrote;
+    }
+    flush();
+
+    cout << "L1 " << header.block_size << "/" << header.ways << "/"
+         << header.size_kib << " KiB " << header.policy << ": "
+         << header.accesses << " accesses, " << misses << " reached L2\n";
+    cout << "L2: " << counts[RH] << " read hits, " << counts[RM]
+         << " read misses, " << counts[WH] << " write hits, " << counts[WM]
+         << " write misses, " << mem_writes << " accesses writing memory\n";
+    return 0;
+}
+
+template < typename System >
+void write_summary(const System& cache_sys, const string& tracename) {
+    // totals go to stdout as well, the per-set breakdown only to the file
+    ofstream summary(tracename + ".summary");
+    for (auto* out : {static_cast< std::ostream* >(&cout),
+                      static_cast< std::ostream* >(&summary)}) {
+        if (cache_sys.miss_classes) {
+            cache_sys.miss_classes->l1.report_totals(*out, "L1");
+            cache_sys.miss_classes->l2.report_totals(*out, "L2");
+        }
+        if (cache_sys.prefetcher) {
+            cache_sys.prefetcher->report(*out);
+        }
+        if (cache_sys.dram) {
+            cache_sys.dram->report(*out);
+        }
+        if (cache_sys.timing) {
+            cache_sys.timing->report(*out);
+        }
+    }
+    if (cache_sys.miss_classes) {
+        summary << '\n';
+        cache_sys.miss_classes->l1.report_sets(summary, "L1");
+        summary << '\n';
+        cache_sys.miss_classes->l2.report_sets(summary, "L2");
+    }
+}
+
+template < typename Policy, typename Hierarchy >
+int run_exact(const Config& cacheconfig, const Options& opts,
+              const string& tracename) {
+    const bool prefetching = cacheconfig.prefetcher != "none";
+    const bool exporting = !opts.export_l2.empty();
+    if (exporting && prefetching) {
+        throw std::invalid_argument(
+            "prefetch fills can't be exported as an L1-filtered trace");
+    }
+    const bool saving = !opts.save_snapshot.empty();
+    const bool timing = cacheconfig.dram || cacheconfig.mshr;
+    const bool windows = !opts.timeseries.empty();
+    if (opts.threads > 1 && (opts.three_c || prefetching || exporting ||
+                             saving || timing || windows)) {
+        cout << "miss classification, prefetching, trace export, snapshots, "
+                "timing models and time series need the whole trace, running "
+                "on one thread"
+             << endl;
+    } else if (opts.threads > 1) {
+        const unsigned partitions =
+            partition_count(cacheconfig, opts.threads);
+        if (partitions > 1) {
+            return run_partitioned< Policy, Hierarchy >(
+                cacheconfig, tracename, partitions, opts.load_snapshot);
+        }
+        cout << "sets can't be partitioned for this config, running on one "
+                "thread"
+             << endl;
+    }
+
+    TraceInput traces(tracename);
+    ofstream tracesout;
+    const auto outname = traces.output_base() + ".out";
+    tracesout.open(outname.c_str());
+
+    CacheSystem< Policy, typename Hierarchy::l1, typename Hierarchy::l2 >
+        cache_sys(cacheconfig);
+    if (opts.three_c) {
+        cache_sys.enable_miss_classification(cacheconfig);
+    }
+    if (prefetching) {
+        cache_sys.enable_prefetcher(cacheconfig);
+    }
+    if (cacheconfig.dram) {
+        cache_sys.dram.emplace(*cacheconfig.dram);
+    }
+    if (cacheconfig.mshr) {
+        cache_sys.timing.emplace(*cacheconfig.mshr,
+                                 cache_sys.l1_cache.addr_sys.offset_size,
+                                 cache_sys.l2_cache.addr_sys.offset_size);
+    }
+    if (exporting) {
+        l2trace::Header header;
+        header.block_size = cacheconfig.L1blocksize;
+        header.ways = cacheconfig.L1setsize;
+        header.size_kib = cacheconfig.L1size;
+        header.policy = cacheconfig.policy;
+        cache_sys.l2_export.emplace(opts.export_l2, header);
+    }
+    if (!opts.load_snapshot.empty()) {
+        cache_sys.load_snapshot(opts.load_snapshot, cacheconfig);
+    }
+    std::optional< timeseries::Recorder > series;
+    if (windows) {
+        series.emplace(opts.timeseries, opts.window,
+                       cache_sys.l1_cache.addr_sys.offset_size,
+                       opts.phase_threshold);
+    }
+
+    if (traces.is_open() && tracesout.is_open()) {
+        std::uint64_t accesses = 0;
+        char accesstype;
+        unsigned int addr;
+        while (traces.next(accesstype,
+                           addr)) {  // read mem access file and access Cache
+            // access the L1 and L2 Cache according to the trace;
+            if (accesstype == 'R') {
+                dout << debug::bg::blue << "R" << debug::reset << " " << hex
+                     << addr << dec << " " << bitset< 32 >(addr) << endl;
+            } else {
+                dout << debug::bg::red << "W" << debug::reset << " " << hex
+                     << addr << dec << " " << bitset< 32 >(addr) << endl;
+            }
+            const auto& [l1_ret, l2_ret, mem_ret] =
+                cache_sys.access(accesstype, addr);
+            if (cache_sys.timing) {
+                const auto arrival = traces.time().value_or(
+                    accesses * cacheconfig.mshr->interval);
+                cache_sys.timing->access(arrival, accesstype == 'R', addr,
+                                         l1_ret == RH, l2_ret == RH);
+            }
+            if (series) {
+                series->access(addr, l1_ret == RH || l1_ret == WH,
+                               l2_ret == RH || l2_ret == WH,
+                               mem_ret == WRITEMEM);
+            }
+            accesses++;
+            // Output hit/miss results for L1 and L2 to the output file;
+            tracesout << l1_ret << " " << l2_ret << " " << mem_ret << '\n';
+        }
+        tracesout.close();
+        if (exporting) {
+            cache_sys.l2_export->finish(accesses);
+        }
+        if (saving) {
+            cache_sys.save_snapshot(opts.save_snapshot, cacheconfig);
+        }
+        if (series) {
+            series->finish();
+            cout << series->windows << " windows, " << series->phases.size()
+                 << " phases, " << series->phase_changes << " phase changes";
+            if (series->merged > 0) {
+                cout << ", " << series->merged
+                     << " windows merged into the nearest of "
+                     << timeseries::max_phases << " phases";
+            }
+            cout << endl;
+        }
+
+        if (cache_sys.dram) {
+            cache_sys.dram->drain();
+        }
+        if (cache_sys.miss_classes || cache_sys.prefetcher || cache_sys.dram ||
+            cache_sys.timing) {
+            write_summary(cache_sys, traces.output_base());
+        }
+    } else
+        cout << "Unable to open trace or traceout file ";
+
+    return 0;
+}
+
+Config bench_config(const LevelConfig& l1, const LevelConfig& l2,
+                    const string& policy) {
+    Config cfg;
+    cfg.levels = {l1, l2};
+    cfg.L1blocksize = l1.blocksize;
+    cfg.L1setsize = l1.setsize;
+    cfg.L1size = l1.size;
+    cfg.L2blocksize = l2.blocksize;
+    cfg.L2setsize = l2.setsize;
+    cfg.L2size = l2.size;
+    cfg.policy = policy;
+    return cfg;
+}
+
+int run_bench(int argc, char* argv[]) {
+    /*
+     * ./cachesimulator.out --bench[=<results>] [--bench-accesses=<N>]
+     *
+     * Simulator throughput on the synthetic streams of synthetic.h, for
+     * every replacement policy on the compile-time geometries plus one
+     * runtime-sized one. Streams are generated before the clock starts and
+     * only CacheSystem::access is timed. Results go to <results> as JSON
+     * (bench.json by default), the miss rates in it double as a check that
+     * a speedup didn't change what is simulated.
+     */
+    string results_name = "bench.json";
+    std::size_t n = 1 << 18;
+    for (int i = 1; i < argc; i++) {
+        const string arg = argv[i];
+        const auto eq = arg.find('=');
+        const string key = arg.substr(0, eq);
+        const string value = eq == string::npos ? "" : arg.substr(eq + 1);
+        if (key == "--bench") {
+            if (!value.empty()) {
+                results_name = value;
+            }
+        } else if (key == "--bench-accesses") {
+            n = std::max(std::stoull(value), 1ULL);
+        } else {
+            throw std::invalid_argument("unknown option: " + arg);
+        }
+    }
+    ofstream results(results_name);
+    if (!results.is_open()) {
+        throw std::runtime_error("cannot open " + results_name);
+    }
+
+    constexpr std::uint64_t seed = 42;
+    const std::vector< std::pair< LevelConfig, LevelConfig > > geometries = {
+        {{8, 1, 16}, {8, 1, 32}},
+        {{4, 2, 16}, {4, 4, 32}},
+        {{64, 8, 32}, {64, 8, 256}},
+        {{32, 4, 16}, {32, 8, 128}},  // runtime-sized path
+    };
+    const std::vector< string > policies = {
+        replacement::RoundRobin::name, replacement::Fifo::name,
+        replacement::Lru::name,        replacement::TreePlru::name,
+        replacement::Srrip::name,      replacement::Brrip::name,
+        replacement::Random::name};
+
+    results << "{\n  \"accesses_per_stream\": " << n
+            << ",\n  \"seed\": " << seed << ",\n  \"results\": [";
+    cout << left << setw(15) << "pattern" << setw(22) << "geometry"
+         << setw(12) << "policy" << right << setw(14) << "accesses/s"
+         << setw(10) << "L1 miss" << setw(10) << "L2 miss" << endl;
+    bool first = true;
+    for (const auto p : synthetic::patterns) {
+        const auto stream = synthetic::Generator(seed).generate(p, n);
+        for (const auto& [l1, l2] : geometries) {
+            std::ostringstream geometry;
+            geometry << l1.blocksize << '/' << l1.setsize << '/' << l1.size
+                     << '-' << l2.blocksize << '/' << l2.setsize << '/'
+                     << l2.size;
+            for (const auto& policy : policies) {
+                const Config cfg = bench_config(l1, l2, policy);
+                std::uint64_t l1_misses = 0;
+                std::uint64_t l2_misses = 0;
+                bool specialized = true;
+                std::chrono::duration< double > elapsed;
+                replacement::with_policy(policy, [&](auto tag) {
+                    using Policy = typename decltype(tag)::type;
+                    with_geometry(
+                        cfg,
+                        [&](auto hierarchy) {
+                            using Hierarchy =
+                                typename decltype(hierarchy)::type;
+                            specialized = !std::is_same_v< Hierarchy,
+                                                           RuntimeGeometry >;
+                            CacheSystem< Policy, typename Hierarchy::l1,
+                                         typename Hierarchy::l2 >
+                                cache_sys(cfg);
+                            const auto start =
+                                std::chrono::steady_clock::now();
+                            for (const auto& a : stream) {
+                                const auto [l1_ret, l2_ret, mem_ret] =
+                                    cache_sys.access(a.type, a.addr);
+                                l1_misses += l1_ret == RM || l1_ret == WM;
+                                l2_misses += l2_ret == RM || l2_ret == WM;
+                            }
+                            elapsed = std::chrono::steady_clock::now() - start;
+                        },
+                        common_geometries{});
+                });
+                const double rate = n / elapsed.count();
+
+                results << (first ? "" : ",") << "\n    {\"pattern\": \""
+                        << synthetic::name(p) << "\", \"geometry\": \""
+                        << geometry.str() << "\", \"specialized\": "
+                        << (specialized ? "true" : "false")
+                        << ", \"policy\": \"" << policy
+                        << "\", \"seconds\": " << elapsed.count()
+                        << ", \"accesses_per_second\": " << std::fixed
+                        << std::setprecision(0) << rate
+                        << std::defaultfloat << std::setprecision(6)
+                        << ", \"l1_miss_rate\": " << double(l1_misses) / n
+                        << ", \"l2_miss_rate\": "
+                        << (l1_misses ? double(l2_misses) / l1_misses : 0)
+                        << "}";
+                first = false;
+                cout << left << setw(15) << synthetic::name(p) << setw(22)
+                     << geometry.str() << setw(12) << policy << right
+                     << fixed << setprecision(0) << setw(14) << rate
+                     << setprecision(4) << setw(10)
+                     << double(l1_misses) / n << setw(10)
+                     << (l1_misses ? double(l2_misses) / l1_misses : 0)
+                     << endl;
+                cout.copyfmt(oldCoutState);
+            }
+        }
+    }
+    results << "\n  ]\n}\n";
+    return 0;
+}
+
+int run(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]).rfind("--bench", 0) == 0) {
+        return run_bench(argc, argv);
+    }
+    const Options opts(argc, argv);
+    const Config cacheconfig = read_config(argv[1]);
+
+    if (opts.mrc) {
+        return run_mrc(cacheconfig, opts, argv[2]);
+    }
+
+    const bool snapshots =
+        !opts.load_snapshot.empty() || !opts.save_snapshot.empty();
+    if (snapshots &&
+        (opts.replay_l2 || opts.coherence || cacheconfig.needs_hierarchy())) {
+        throw std::invalid_argument(
+            "snapshots hold a plain two-level CacheSystem only");
+    }
+
+    if (opts.replay_l2) {
+        return replacement::with_policy(cacheconfig.policy, [&](auto policy) {
+            using Policy = typename decltype(policy)::type;
+            return run_replay_l2< Policy >(cacheconfig, argv[2]);
+        });
+    }
+
+    if (opts.coherence) {
+        return replacement::with_policy(cacheconfig.policy, [&](auto policy) {
+            using Policy = typename decltype(policy)::type;
+            return run_coherent< Policy >(cacheconfig, opts, argv[2]);
+        });
+    }
+
+    if (cacheconfig.needs_hierarchy()) {
+        if (opts.three_c || cacheconfig.prefetcher != "none" ||
+            !opts.export_l2.empty() || cacheconfig.dram || cacheconfig.mshr ||
+            !opts.timeseries.empty()) {
+            throw std::invalid_argument(
+                "miss classification, prefetching, trace export, timing "
+                "models and time series need a plain two-level config");
+        }
+        // one instantiation per policy and depth
+        return replacement::with_policy(cacheconfig.policy, [&](auto policy) {
+            using Policy = typename decltype(policy)::type;
+            return dispatch_depth< Policy >(cacheconfig, argv[2]);
+        });
+    }
+
+    // pick the policy and geometry once, the simulation loop is specialized
+    // for both
+    return replacement::with_policy(cacheconfig.policy, [&](auto policy) {
+        using Policy = typename decltype(policy)::type;
+        return with_geometry(
+            cacheconfig,
+            [&](auto hierarchy) {
+                using Hierarchy = typename decltype(hierarchy)::type;
+                return run_exact< Policy, Hierarchy >(cacheconfig, opts,
+                                                      argv[2]);
+            },
+            common_geometries{});
+    });
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        return run(argc, argv);
+    } catch (const std::invalid_argument& e) {
+        // a bad option or config, not a simulator failure
+        cout << "error: " << e.what() << endl
+             << "usage: " << argv[0]
+             << " <config> <trace> [options], or --bench[=<results>]"
+             << endl;
+        return 1;
+    }
+}
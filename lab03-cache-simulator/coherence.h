@@ -0,0 +1,116 @@
+/* Multi-core cache coherence (MESI)
+
+Every core has a private L1, all cores share the L2 behind a snooping bus.
+Each L1 line is in one of the MESI states:
+- modified    the only copy, dirty
+- exclusive   the only copy, clean; a write turns it modified without a bus
+              transaction
+- shared      other L1s may hold copies, a write first invalidates them
+              (an upgrade)
+- invalid     not cached
+
+Bus transactions:
+- read miss     a modified or exclusive copy elsewhere is downgraded to shared,
+                a modified one supplies the data (a cache-to-cache transfer)
+                and is written back to the L2; without any other copy the L1
+                gets the block exclusive
+- write miss    every other copy is invalidated, a modified one supplies the
+                data; the L1 gets the block modified
+- upgrade       write hit on a shared line, every other copy is invalidated
+
+A transfer is counted as false sharing when the supplying core never wrote
+the word the requester asks for since it took ownership, i.e. the two cores
+only share the block, not the data.
+*/
+
+#ifndef COHERENCE_H_
+#define COHERENCE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+
+namespace coherence {
+
+enum class mesi : std::uint8_t { invalid, shared, exclusive, modified };
+
+struct Line {
+    mesi state = mesi::invalid;
+    std::uint64_t written = 0;  // words written since taking ownership
+};
+
+inline std::uint64_t word_bit(unsigned offset, unsigned offset_size) {
+    // 4-byte words, coarser for blocks over 256 bytes to fit 64 bits
+    const unsigned word_shift = offset_size > 8 ? offset_size - 6 : 2;
+    return 1UL << (offset >> word_shift);
+}
+
+struct Access {
+    std::uint64_t pos;  // position in the interleaved trace
+    char type;
+    unsigned addr;
+};
+
+struct CoreStats {
+    std::uint64_t reads = 0;
+    std::uint64_t writes = 0;
+    std::uint64_t read_hits = 0;
+    std::uint64_t write_hits = 0;
+    std::uint64_t upgrades = 0;     // write hits on shared lines
+    std::uint64_t invalidated = 0;  // lines lost to other cores' writes
+
+    void report(std::ostream& out, int core) const {
+        out << "core " << core << ": " << reads << " reads (" << read_hits
+            << " hits), " << writes << " writes (" << write_hits
+            << " hits), " << upgrades << " upgrades, " << invalidated
+            << " lines invalidated\n";
+    }
+};
+
+struct BusStats {
+    std::uint64_t invalidations = 0;  // copies invalidated in other L1s
+    std::uint64_t upgrades = 0;
+    std::uint64_t transfers = 0;      // modified lines supplied by an L1
+    std::uint64_t false_sharing = 0;  // transfers of words never written
+    std::uint64_t l2_hits = 0;
+    std::uint64_t l2_misses = 0;
+    std::uint64_t mem_writes = 0;
+
+    void report(std::ostream& out) const {
+        out << "bus: " << invalidations << " invalidations, " << upgrades
+            << " upgrades, " << transfers << " cache-to-cache transfers ("
+            << false_sharing << " false sharing)\n";
+        out << "L2: " << l2_hits << " hits, " << l2_misses << " misses, "
+            << mem_writes << " memory writes\n";
+    }
+};
+
+class Barrier {
+    // reusable barrier for a fixed number of threads
+   public:
+    explicit Barrier(unsigned count_) : count(count_) {}
+
+    void arrive_and_wait() {
+        std::unique_lock< std::mutex > lock(mutex);
+        const auto phase = generation;
+        if (++arrived == count) {
+            arrived = 0;
+            generation++;
+            released.notify_all();
+        } else {
+            released.wait(lock, [&] { return generation != phase; });
+        }
+    }
+
+   private:
+    std::mutex mutex;
+    std::condition_variable released;
+    unsigned count;
+    unsigned arrived = 0;
+    std::uint64_t generation = 0;
+};
+
+}  // namespace coherence
+
+#endif
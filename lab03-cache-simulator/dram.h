@@ -0,0 +1,219 @@
+/* Main memory timing model
+
+DRAM below L2, in memory-controller cycles:
+- channels, each with its own command/data bus and request queue
+- banks per channel, each with one row buffer
+- address mapping (LSB -> MSB): column || channel || bank || row, so
+  consecutive rows' worth of bytes spread over channels, then banks
+
+Timing of a column access:
+- row hit       tCAS                    (open page policy only)
+- row empty     tRCD + tCAS
+- row conflict  tRP + tRCD + tCAS       (another row is open)
+then the data occupies the channel bus for `burst` cycles. With the closed
+page policy every access auto-precharges, the bank is busy for another tRP
+after the data and rows are never hit.
+
+The trace has no timing, so a new trace access arrives every `interval`
+cycles. Requests from that access (L2 misses, writes past L2, dirty L2
+victims) queue at their channel. Each channel issues one command per cycle,
+FR-FCFS: among the queued requests, those whose bank is ready go first, row
+hits before others, the oldest among equals.
+*/
+
+#ifndef DRAM_H_
+#define DRAM_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace dram {
+
+struct Params {
+    int channels = 1;
+    int banks = 8;
+    int row_bytes = 2048;
+    bool open_page = true;
+    int tRCD = 14;
+    int tCAS = 14;
+    int tRP = 14;
+    int burst = 4;      // data bus cycles per block
+    int interval = 10;  // cycles between trace accesses
+};
+
+struct Stats {
+    std::uint64_t reads = 0;
+    std::uint64_t writes = 0;
+    std::uint64_t row_hits = 0;
+    std::uint64_t row_empty = 0;
+    std::uint64_t row_conflicts = 0;
+    std::uint64_t read_latency = 0;  // sum, arrival to last data beat
+    std::uint64_t write_latency = 0;
+};
+
+class Controller {
+   public:
+    explicit Controller(const Params& params_)
+        : params(params_),
+          column_bits(log2_exact(params.row_bytes, "row size")),
+          channel_bits(log2_exact(params.channels, "channel count")),
+          bank_bits(log2_exact(params.banks, "bank count")),
+          channels(params.channels, Channel(params.banks)) {
+        if (params.tRCD < 0 || params.tCAS < 0 || params.tRP < 0 ||
+            params.burst < 1 || params.interval < 1) {
+            throw std::invalid_argument("bad DRAM timing");
+        }
+    }
+
+    // the next trace access arrives
+    void tick() {
+        now += params.interval;
+        for (auto& channel : channels) {
+            advance(channel, now);
+        }
+    }
+
+    void read(unsigned addr) { enqueue(addr, false); }
+    void write(unsigned addr) { enqueue(addr, true); }
+
+    // serve everything still queued
+    void drain() {
+        for (auto& channel : channels) {
+            advance(channel, UINT64_MAX);
+        }
+    }
+
+    void report(std::ostream& out) const {
+        const auto ratio = [](double a, double b) { return b > 0 ? a / b : 0; };
+        const auto requests = stats.reads + stats.writes;
+        out << "DRAM: " << stats.reads << " reads, " << stats.writes
+            << " writes, row buffer hit rate "
+            << ratio(stats.row_hits, requests) << " (" << stats.row_hits
+            << " hits, " << stats.row_empty << " empty, "
+            << stats.row_conflicts << " conflicts)\n";
+        out << "  average latency " << ratio(stats.read_latency +
+                                                 stats.write_latency,
+                                             requests)
+            << " cycles, reads " << ratio(stats.read_latency, stats.reads)
+            << ", writes " << ratio(stats.write_latency, stats.writes)
+            << '\n';
+    }
+
+    Stats stats;
+
+   private:
+    struct Request {
+        std::uint64_t arrival;
+        unsigned bank;
+        unsigned row;
+        bool is_write;
+    };
+
+    struct Bank {
+        std::uint64_t ready = 0;  // next command may issue
+        bool row_open = false;
+        unsigned row = 0;
+    };
+
+    struct Channel {
+        explicit Channel(int banks_) : banks(banks_) {}
+
+        std::vector< Bank > banks;
+        std::vector< Request > queue;
+        std::uint64_t now = 0;  // command bus
+        std::uint64_t bus_ready = 0;
+    };
+
+    static int log2_exact(int n, const char* what) {
+        if (n <= 0 || (n & (n - 1)) != 0) {
+            throw std::invalid_argument(std::string("DRAM ") + what +
+                                        " must be a power of two");
+        }
+        return __builtin_ctz(n);
+    }
+
+    void enqueue(unsigned addr, bool is_write) {
+        unsigned rest = addr >> column_bits;
+        const unsigned channel = rest & (params.channels - 1);
+        rest >>= channel_bits;
+        const unsigned bank = rest & (params.banks - 1);
+        const unsigned row = rest >> bank_bits;
+        channels[channel].queue.push_back({now, bank, row, is_write});
+    }
+
+    void advance(Channel& channel, std::uint64_t until) {
+        // issue queued requests while their command slot is before `until`
+        auto& queue = channel.queue;
+        while (!queue.empty()) {
+            // nothing arrived yet means idle until the oldest arrival
+            channel.now = std::max(channel.now, queue.front().arrival);
+            if (channel.now >= until) {
+                return;
+            }
+            const auto rank = [&](const Request& r) {
+                const auto& bank = channel.banks[r.bank];
+                const bool ready = bank.ready <= channel.now;
+                const bool hit = bank.row_open && bank.row == r.row;
+                return std::make_pair(!ready, !hit);
+            };
+            auto best = queue.begin();
+            for (auto it = queue.begin(); it != queue.end(); it++) {
+                if (it->arrival > channel.now) {
+                    break;  // queue is in arrival order
+                }
+                if (rank(*it) < rank(*best)) {
+                    best = it;
+                }
+            }
+            const auto request = *best;
+            queue.erase(best);
+            issue(channel, request);
+        }
+    }
+
+    void issue(Channel& channel, const Request& r) {
+        auto& bank = channel.banks[r.bank];
+        const std::uint64_t start = std::max(channel.now, bank.ready);
+        std::uint64_t access = params.tCAS;
+        if (bank.row_open && bank.row == r.row) {
+            stats.row_hits++;
+        } else if (bank.row_open) {
+            stats.row_conflicts++;
+            access += params.tRP + params.tRCD;
+        } else {
+            stats.row_empty++;
+            access += params.tRCD;
+        }
+        const std::uint64_t data = std::max(start + access, channel.bus_ready);
+        const std::uint64_t done = data + params.burst;
+        channel.bus_ready = done;
+        channel.now = start + 1;
+
+        if (params.open_page) {
+            bank.row_open = true;
+            bank.row = r.row;
+            bank.ready = data;
+        } else {
+            bank.row_open = false;
+            bank.ready = done + params.tRP;
+        }
+        (r.is_write ? stats.writes : stats.reads)++;
+        (r.is_write ? stats.write_latency : stats.read_latency) +=
+            done - r.arrival;
+    }
+
+    Params params;
+    int column_bits;
+    int channel_bits;
+    int bank_bits;
+    std::vector< Channel > channels;
+    std::uint64_t now = 0;
+};
+
+}  // namespace dram
+
+#endif
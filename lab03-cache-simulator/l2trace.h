@@ -0,0 +1,165 @@
+/* L1-filtered trace, the binary stream of what reaches L2
+
+A run with a fixed L1 can record every interaction between L1 and L2, and a
+later run replays only that stream against a different L2 without simulating
+L1 again. All integers are little-endian.
+
+Header, 48 bytes:
+    offset  size
+    0       4     magic "L2TR"
+    4       4     format version (1)
+    8       4     L1 block size in bytes
+    12      4     L1 associativity
+    16      4     L1 size in KiB
+    20      16    L1 replacement policy name, NUL padded
+    36      8     number of accesses in the original trace
+    44      4     reserved, 0
+
+Records, 8 bytes each, in simulation order:
+    0       4     address
+    4       1     kind
+    5       3     reserved, 0
+
+Kinds:
+    read           L1 read miss, looked up in L2 (a hit moves the block up)
+    write          L1 write miss, written to L2 or memory (no allocation)
+    insert         clean block evicted from L1 into L2, block address
+    insert_dirty   same for a dirty block
+
+Each read or write record starts the L2 part of one access; an insert that
+follows belongs to the same access, since the L1 fill made room for the
+block it just read.
+*/
+
+#ifndef L2TRACE_H_
+#define L2TRACE_H_
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace l2trace {
+
+constexpr std::array< char, 4 > magic = {'L', '2', 'T', 'R'};
+constexpr std::uint32_t version = 1;
+constexpr std::size_t header_size = 48;
+constexpr std::size_t record_size = 8;
+
+enum kind : std::uint8_t { read = 0, write = 1, insert = 2, insert_dirty = 3 };
+
+struct Header {
+    std::uint32_t block_size = 0;
+    std::uint32_t ways = 0;
+    std::uint32_t size_kib = 0;
+    std::string policy;
+    std::uint64_t accesses = 0;
+};
+
+struct Record {
+    std::uint32_t addr;
+    kind type;
+};
+
+inline void put_le(char* out, std::uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out[i] = static_cast< char >((value >> (8 * i)) & 0xff);
+    }
+}
+
+inline std::uint64_t get_le(const char* in, int bytes) {
+    std::uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= static_cast< std::uint64_t >(
+                     static_cast< unsigned char >(in[i]))
+                 << (8 * i);
+    }
+    return value;
+}
+
+class Writer {
+   public:
+    Writer(const std::string& filename, Header header_)
+        : out(filename, std::ios::binary), header(std::move(header_)) {
+        if (!out.is_open()) {
+            throw std::runtime_error("cannot open " + filename);
+        }
+        write_header();  // rewritten with the final count by finish()
+    }
+
+    void record(std::uint32_t addr, kind type) {
+        char buffer[record_size] = {};
+        put_le(buffer, addr, 4);
+        buffer[4] = static_cast< char >(type);
+        out.write(buffer, record_size);
+    }
+
+    void finish(std::uint64_t accesses) {
+        header.accesses = accesses;
+        out.seekp(0);
+        write_header();
+        out.close();
+    }
+
+   private:
+    void write_header() {
+        char buffer[header_size] = {};
+        std::memcpy(buffer, magic.data(), magic.size());
+        put_le(buffer + 4, version, 4);
+        put_le(buffer + 8, header.block_size, 4);
+        put_le(buffer + 12, header.ways, 4);
+        put_le(buffer + 16, header.size_kib, 4);
+        std::strncpy(buffer + 20, header.policy.c_str(), 15);
+        put_le(buffer + 36, header.accesses, 8);
+        out.write(buffer, header_size);
+    }
+
+    std::ofstream out;
+    Header header;
+};
+
+class Reader {
+   public:
+    explicit Reader(const std::string& filename)
+        : in(filename, std::ios::binary) {
+        char buffer[header_size];
+        if (!in.read(buffer, header_size) ||
+            std::memcmp(buffer, magic.data(), magic.size()) != 0) {
+            throw std::invalid_argument(filename +
+                                        " is not an L1-filtered trace");
+        }
+        if (get_le(buffer + 4, 4) != version) {
+            throw std::invalid_argument(filename +
+                                        ": unsupported format version");
+        }
+        header.block_size = get_le(buffer + 8, 4);
+        header.ways = get_le(buffer + 12, 4);
+        header.size_kib = get_le(buffer + 16, 4);
+        header.policy.assign(buffer + 20, strnlen(buffer + 20, 16));
+        header.accesses = get_le(buffer + 36, 8);
+    }
+
+    bool next(Record& record) {
+        char buffer[record_size];
+        if (!in.read(buffer, record_size)) {
+            return false;
+        }
+        record.addr = get_le(buffer, 4);
+        record.type = static_cast< kind >(buffer[4]);
+        if (record.type > insert_dirty) {
+            throw std::invalid_argument("unknown record kind");
+        }
+        return true;
+    }
+
+    Header header;
+
+   private:
+    std::ifstream in;
+};
+
+}  // namespace l2trace
+
+#endif
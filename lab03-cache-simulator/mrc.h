@@ -0,0 +1,284 @@
+/* Approximate miss ratio curve (MRC) estimation
+
+Spatially hashed sampling (SHARDS, Waldspurger et al., FAST '15):
+- every block address is hashed into [0, P)
+- only blocks whose hash falls below a threshold T are tracked, so the
+  sampling rate is R = T / P
+- reuse distances measured among the sampled blocks are scaled by 1 / R to
+  estimate the reuse distance in the full trace
+
+The fixed-size variant is used so memory stays constant no matter how long the
+trace is: once more than `max_blocks` distinct blocks are tracked, the block
+with the largest hash is dropped and T is lowered to that hash, and everything
+counted so far is rescaled to the new rate.
+
+The curve estimates a fully-associative LRU cache, so it bounds what a set
+associative cache of the same capacity can achieve.
+*/
+
+#ifndef MRC_H_
+#define MRC_H_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace mrc {
+
+constexpr std::uint64_t hash_modulus = 1UL << 24;  // P
+
+inline std::uint64_t hash_block(std::uint64_t block) {
+    // splitmix64 finalizer, spreads sequential block numbers evenly
+    block += 0x9e3779b97f4a7c15UL;
+    block = (block ^ (block >> 30)) * 0xbf58476d1ce4e5b9UL;
+    block = (block ^ (block >> 27)) * 0x94d049bb133111ebUL;
+    return (block ^ (block >> 31)) % hash_modulus;
+}
+
+class ReuseHistogram {
+    /*
+     * Log-scaled histogram of (scaled) reuse distances
+     *   - 2^sub_bits bins per power of two, so bins are at most ~6% wide
+     *   - fixed number of bins, independent of trace length
+     */
+   public:
+    static constexpr int sub_bits = 4;
+    static constexpr int n_octaves = 48;
+    static constexpr int n_bins = n_octaves << sub_bits;
+
+    static int bin_of(std::uint64_t distance) {
+        if (distance < (1UL << sub_bits)) {
+            return static_cast< int >(distance);
+        }
+        const int msb = 63 - __builtin_clzll(distance);
+        const int shift = msb - sub_bits;
+        const int sub = static_cast< int >((distance >> shift) &
+                                           ((1UL << sub_bits) - 1));
+        return std::min(((shift + 1) << sub_bits) + sub, n_bins - 1);
+    }
+
+    static std::uint64_t lower_bound_of(int bin) {
+        if (bin < (1 << sub_bits)) {
+            return bin;
+        }
+        const int shift = (bin >> sub_bits) - 1;
+        const std::uint64_t sub = bin & ((1 << sub_bits) - 1);
+        return ((1UL << sub_bits) | sub) << shift;
+    }
+
+    void add(std::uint64_t distance, double weight) {
+        bins[bin_of(distance)] += weight;
+    }
+
+    void scale(double factor) {
+        for (auto& b : bins) {
+            b *= factor;
+        }
+    }
+
+    // weight of all distances >= distance
+    double tail(std::uint64_t distance) const {
+        double sum = 0;
+        for (int i = n_bins - 1; i >= 0 && lower_bound_of(i) >= distance;
+             i--) {
+            sum += bins[i];
+        }
+        return sum;
+    }
+
+    std::array< double, n_bins > bins = {};
+};
+
+class FenwickTree {
+    /*
+     * counts live timestamps, so the number of distinct blocks touched after
+     * a given time is a prefix-sum query
+     */
+   public:
+    explicit FenwickTree(std::size_t size_) : tree(size_ + 1, 0) {}
+
+    void add(std::size_t pos, int delta) {
+        for (pos++; pos < tree.size(); pos += pos & (~pos + 1)) {
+            tree[pos] += delta;
+        }
+    }
+
+    // sum over [0, pos)
+    long prefix(std::size_t pos) const {
+        long sum = 0;
+        for (; pos > 0; pos -= pos & (~pos + 1)) {
+            sum += tree[pos];
+        }
+        return sum;
+    }
+
+    void clear() { std::fill(tree.begin(), tree.end(), 0); }
+
+    std::size_t size() const { return tree.size() - 1; }
+
+   private:
+    std::vector< int > tree;
+};
+
+class ShardsSampler {
+   public:
+    ShardsSampler(unsigned block_size_, double initial_rate,
+                  std::size_t max_blocks_)
+        : block_shift(std::lround(std::ceil(std::log2(block_size_)))),
+          threshold(std::max< std::uint64_t >(
+              1, std::llround(initial_rate * hash_modulus))),
+          max_blocks(max_blocks_),
+          live(2 * max_blocks_ + 2) {
+        if (initial_rate <= 0 || initial_rate > 1) {
+            throw std::invalid_argument("sampling rate must be in (0, 1]");
+        }
+        if (max_blocks == 0) {
+            throw std::invalid_argument("need room for at least one block");
+        }
+        tracked.reserve(max_blocks + 1);
+    }
+
+    void access(unsigned addr) {
+        n_accesses++;
+        const std::uint64_t block = addr >> block_shift;
+        const std::uint64_t hash = hash_block(block);
+        if (hash >= threshold) {
+            return;
+        }
+        n_sampled++;
+        sampled_weight += 1;
+
+        if (now == live.size()) {
+            compact();
+        }
+
+        const auto found = tracked.find(block);
+        if (found == tracked.end()) {
+            cold_weight += 1;
+            tracked.emplace(block, Entry{now, hash});
+            by_hash.emplace(hash, block);
+            live.add(now, 1);
+            now++;
+            if (tracked.size() > max_blocks) {
+                lower_threshold();
+            }
+        } else {
+            auto& entry = found->second;
+            // distinct sampled blocks touched since the last reference
+            const long distance =
+                live.prefix(now) - live.prefix(entry.time + 1);
+            histogram.add(std::llround(distance / rate()), 1);
+            live.add(entry.time, -1);
+            entry.time = now;
+            live.add(now, 1);
+            now++;
+        }
+    }
+
+    double rate() const {
+        return static_cast< double >(threshold) / hash_modulus;
+    }
+
+    // sampled weight the final rate should have produced, SHARDS_adj
+    double expected_weight() const { return n_accesses * rate(); }
+
+    double miss_ratio(std::uint64_t cache_blocks) const {
+        const double total = std::max(expected_weight(), 1e-9);
+        // attribute sampling error to the nearest reuse distance, so it
+        // only shows up at tiny cache sizes
+        const double correction =
+            cache_blocks == 0 ? expected_weight() - sampled_weight : 0;
+        const double misses =
+            cold_weight + histogram.tail(cache_blocks) + correction;
+        return std::clamp(misses / total, 0.0, 1.0);
+    }
+
+    // half-width of the 95% confidence interval for miss_ratio()
+    double error_bound(std::uint64_t cache_blocks) const {
+        const double m = miss_ratio(cache_blocks);
+        const double n = std::max< double >(expected_weight(), 1);
+        // finite population correction, no sampling error at R = 1
+        const double fpc = std::sqrt(std::max(0.0, 1 - rate()));
+        return 1.96 * fpc * std::sqrt(m * (1 - m) / n) +
+               std::abs(expected_weight() - sampled_weight) / n;
+    }
+
+    std::uint64_t max_distance() const {
+        for (int i = ReuseHistogram::n_bins - 1; i >= 0; i--) {
+            if (histogram.bins[i] > 0) {
+                return ReuseHistogram::lower_bound_of(i);
+            }
+        }
+        return 0;
+    }
+
+    std::uint64_t accesses() const { return n_accesses; }
+    std::uint64_t sampled() const { return n_sampled; }
+    std::size_t tracked_blocks() const { return tracked.size(); }
+
+   private:
+    struct Entry {
+        std::size_t time;
+        std::uint64_t hash;
+    };
+
+    void lower_threshold() {
+        // drop every block sharing the largest hash, then sample below it
+        const double old_rate = rate();
+        const std::uint64_t new_threshold = by_hash.rbegin()->first;
+        while (!by_hash.empty() && by_hash.rbegin()->first >= new_threshold) {
+            const auto victim = std::prev(by_hash.end());
+            const auto entry = tracked.find(victim->second);
+            live.add(entry->second.time, -1);
+            tracked.erase(entry);
+            by_hash.erase(victim);
+        }
+        threshold = new_threshold;
+
+        const double factor = rate() / old_rate;
+        histogram.scale(factor);
+        cold_weight *= factor;
+        sampled_weight *= factor;
+    }
+
+    void compact() {
+        // renumber live timestamps to 0..n-1, preserving order
+        std::vector< std::pair< std::size_t, std::uint64_t > > order;
+        order.reserve(tracked.size());
+        for (const auto& [block, entry] : tracked) {
+            order.emplace_back(entry.time, block);
+        }
+        std::sort(order.begin(), order.end());
+        live.clear();
+        for (std::size_t i = 0; i < order.size(); i++) {
+            tracked[order[i].second].time = i;
+            live.add(i, 1);
+        }
+        now = order.size();
+    }
+
+    unsigned block_shift;
+    std::uint64_t threshold;  // T
+    std::size_t max_blocks;
+
+    std::unordered_map< std::uint64_t, Entry > tracked;
+    std::set< std::pair< std::uint64_t, std::uint64_t > > by_hash;
+    FenwickTree live;
+    std::size_t now = 0;
+
+    ReuseHistogram histogram;
+    double cold_weight = 0;
+    double sampled_weight = 0;
+    std::uint64_t n_accesses = 0;
+    std::uint64_t n_sampled = 0;
+};
+
+}  // namespace mrc
+
+#endif
@@ -0,0 +1,228 @@
+/* Non-blocking cache timing with MSHRs
+
+The functional simulation (CacheSystem) decides hits and misses access by
+access; this layer puts them on a time line. Every level has a file of miss
+status holding registers (MSHRs), one per block in flight:
+- primary miss     a read missing a level allocates an MSHR until the block
+                   arrives (L2 latency, or L2 plus memory latency)
+- secondary miss   a read to a block that is still in flight merges into its
+                   MSHR and waits for the same fill, without a new request
+- structural stall no free MSHR: the core waits for the oldest fill before
+                   it can issue the miss, and every later access waits too
+Writes are posted (write buffer) and never wait.
+
+Accesses arrive at the cycle in the trace's third column, or `interval`
+cycles apart when the trace has no timestamps, and issue in order.
+
+Reported:
+- memory-level parallelism (MLP), the average number of misses in flight
+  while at least one is, per level
+- effective miss latency, arrival to data for L1 read misses, including
+  merging and stalls, next to the unloaded L2 / memory latencies
+*/
+
+#ifndef MSHR_H_
+#define MSHR_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+namespace mshr {
+
+struct Params {
+    int l1_mshrs = 8;
+    int l2_mshrs = 16;
+    int l1_latency = 1;     // cycles
+    int l2_latency = 10;    // L1 miss, L2 hit
+    int mem_latency = 100;  // on top of l2_latency
+    int interval = 1;       // cycles between accesses without timestamps
+};
+
+class File {
+   public:
+    explicit File(int capacity_) : capacity(capacity_) {
+        if (capacity < 1) {
+            throw std::invalid_argument("need at least one MSHR per level");
+        }
+    }
+
+    // fill time of `block` if it is in flight at `now`
+    bool find(std::uint64_t block, std::uint64_t now, std::uint64_t& ready) {
+        retire(now);
+        for (const auto& e : entries) {
+            if (e.block == block) {
+                ready = e.ready;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // earliest cycle from `now` on with a free MSHR
+    std::uint64_t free_at(std::uint64_t now) {
+        retire(now);
+        if (entries.size() < static_cast< std::size_t >(capacity)) {
+            return now;
+        }
+        return std::min_element(entries.cbegin(), entries.cend(),
+                                [](const Entry& a, const Entry& b) {
+                                    return a.ready < b.ready;
+                                })
+            ->ready;
+    }
+
+    // the caller waited for free_at(now) first
+    void allocate(std::uint64_t block, std::uint64_t now,
+                  std::uint64_t ready) {
+        retire(now);
+        entries.push_back({block, ready});
+    }
+
+   private:
+    struct Entry {
+        std::uint64_t block;
+        std::uint64_t ready;
+    };
+
+    void retire(std::uint64_t now) {
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                     [now](const Entry& e) {
+                                         return e.ready <= now;
+                                     }),
+                      entries.end());
+    }
+
+    int capacity;
+    std::vector< Entry > entries;
+};
+
+class Overlap {
+    // busy time and summed lengths of [start, end) intervals, starts mostly
+    // in increasing order
+   public:
+    void add(std::uint64_t start, std::uint64_t end) {
+        total += end - start;
+        const auto from = std::max(start, covered_until);
+        if (end > from) {
+            busy += end - from;
+        }
+        covered_until = std::max(covered_until, end);
+    }
+
+    double parallelism() const { return busy ? double(total) / busy : 0; }
+
+   private:
+    std::uint64_t total = 0;
+    std::uint64_t busy = 0;
+    std::uint64_t covered_until = 0;
+};
+
+struct Stats {
+    std::uint64_t reads = 0;
+    std::uint64_t l1_primary = 0;
+    std::uint64_t l1_secondary = 0;  // merged into an in-flight L1 MSHR
+    std::uint64_t l2_primary = 0;
+    std::uint64_t l2_secondary = 0;
+    std::uint64_t l1_stall_cycles = 0;  // waiting for a free L1 MSHR
+    std::uint64_t l2_stall_cycles = 0;
+    std::uint64_t miss_latency = 0;  // sum over L1 read misses
+    std::uint64_t last_cycle = 0;
+};
+
+class Timing {
+   public:
+    Timing(const Params& params_, int l1_offset_bits_, int l2_offset_bits_)
+        : params(params_),
+          l1_offset_bits(l1_offset_bits_),
+          l2_offset_bits(l2_offset_bits_),
+          l1(params.l1_mshrs),
+          l2(params.l2_mshrs) {}
+
+    // the next access, with its functional L1 and L2 outcome
+    void access(std::uint64_t arrival, bool is_read, unsigned addr,
+                bool l1_hit, bool l2_hit) {
+        std::uint64_t now = std::max(arrival, issue_ready);
+        issue_ready = now;
+        if (!is_read) {
+            finish(now);
+            return;
+        }
+        stats.reads++;
+        const std::uint64_t block1 = addr >> l1_offset_bits;
+        std::uint64_t ready;
+        if (l1.find(block1, now, ready)) {
+            // the functional model already filled it, the data is not here
+            stats.l1_secondary++;
+        } else if (l1_hit) {
+            finish(now + params.l1_latency);
+            return;
+        } else {
+            stats.l1_primary++;
+            const auto free = l1.free_at(now);
+            stats.l1_stall_cycles += free - now;
+            now = free;
+            issue_ready = now;
+            ready = l2_hit ? now + params.l2_latency : l2_miss(addr, now);
+            l1.allocate(block1, now, ready);
+            l1_overlap.add(now, ready);
+        }
+        stats.miss_latency += ready - arrival;
+        finish(ready);
+    }
+
+    void report(std::ostream& out) const {
+        const auto ratio = [](double a, double b) { return b > 0 ? a / b : 0; };
+        const auto misses = stats.l1_primary + stats.l1_secondary;
+        out << "MSHR: " << stats.reads << " reads, L1 misses "
+            << stats.l1_primary << " primary / " << stats.l1_secondary
+            << " merged, L2 misses " << stats.l2_primary << " primary / "
+            << stats.l2_secondary << " merged\n";
+        out << "  MLP L1 " << l1_overlap.parallelism() << ", memory "
+            << mem_overlap.parallelism() << "; effective miss latency "
+            << ratio(stats.miss_latency, misses) << " cycles (unloaded L2 "
+            << params.l2_latency << ", memory "
+            << params.l2_latency + params.mem_latency << ")\n";
+        out << "  stalls on full MSHRs: L1 " << stats.l1_stall_cycles
+            << " cycles, L2 " << stats.l2_stall_cycles << " cycles; "
+            << stats.last_cycle << " cycles total\n";
+    }
+
+    Stats stats;
+
+   private:
+    std::uint64_t l2_miss(unsigned addr, std::uint64_t now) {
+        const std::uint64_t block2 = addr >> l2_offset_bits;
+        std::uint64_t ready;
+        if (l2.find(block2, now, ready)) {
+            stats.l2_secondary++;
+            return ready;
+        }
+        stats.l2_primary++;
+        const auto start = l2.free_at(now);
+        stats.l2_stall_cycles += start - now;
+        ready = start + params.l2_latency + params.mem_latency;
+        l2.allocate(block2, start, ready);
+        mem_overlap.add(start, ready);
+        return ready;
+    }
+
+    void finish(std::uint64_t cycle) {
+        stats.last_cycle = std::max(stats.last_cycle, cycle);
+    }
+
+    Params params;
+    int l1_offset_bits;
+    int l2_offset_bits;
+    File l1;
+    File l2;
+    Overlap l1_overlap;
+    Overlap mem_overlap;
+    std::uint64_t issue_ready = 0;  // in-order issue
+};
+
+}  // namespace mshr
+
+#endif
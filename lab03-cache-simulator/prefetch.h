@@ -0,0 +1,300 @@
+/* Hardware prefetcher models
+
+Prefetchers watch the demand reference stream of one cache level, as block
+numbers (address >> offset bits), and propose blocks to bring in ahead of use:
+- nextline   on a miss to block B, fetch B + distance ... B + distance +
+             degree - 1
+- stride     per 4 KiB region, learn the delta between consecutive blocks (no
+             PC is available in the trace); once the same non-zero delta is
+             seen twice in a row, fetch `degree` blocks starting `distance`
+             strides ahead
+- stream     track a few ascending/descending miss streams; a miss close to
+             the head of a stream confirms it and fetches `degree` blocks
+             starting `distance` blocks past the miss
+
+Engine bundles the selected prefetcher with the bookkeeping for the report:
+- accuracy     useful prefetches / prefetches issued
+- coverage     useful prefetches / (useful prefetches + remaining demand
+               misses), i.e. the share of misses the prefetcher removed
+- timeliness   demand accesses between a prefetch and its first use; a
+               prefetch evicted unused was too early or wrong
+- pollution    demand misses on blocks a prefetch displaced, counted while
+               the block would still be among the level's last `capacity`
+               displacements
+*/
+
+#ifndef PREFETCH_H_
+#define PREFETCH_H_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+namespace prefetch {
+
+struct Params {
+    int degree = 1;    // blocks fetched per trigger
+    int distance = 1;  // how far ahead the first prefetched block is
+};
+
+class NextLine {
+   public:
+    static constexpr const char* name = "nextline";
+
+    explicit NextLine(Params params_) : params(params_) {}
+
+    void train(std::int64_t block, bool miss,
+               std::vector< std::int64_t >& out) {
+        if (!miss) {
+            return;
+        }
+        for (int i = 0; i < params.degree; i++) {
+            out.push_back(block + params.distance + i);
+        }
+    }
+
+   private:
+    Params params;
+};
+
+class Stride {
+   public:
+    static constexpr const char* name = "stride";
+    static constexpr int table_size = 64;
+    static constexpr int region_bits = 12;  // 4 KiB
+    static constexpr int confident = 2;
+
+    Stride(Params params_, int offset_size_)
+        : params(params_), region_shift(region_bits - offset_size_) {}
+
+    void train(std::int64_t block, bool, std::vector< std::int64_t >& out) {
+        const std::int64_t region = block >> std::max(region_shift, 0);
+        auto& entry = table[region % table_size];
+        if (entry.region != region) {
+            entry = Entry{region, block, 0, 0};
+            return;
+        }
+        const std::int64_t delta = block - entry.last_block;
+        entry.last_block = block;
+        if (delta == 0) {
+            return;
+        }
+        if (delta == entry.stride) {
+            entry.confidence = std::min(entry.confidence + 1, confident);
+        } else {
+            entry.stride = delta;
+            entry.confidence = 0;
+        }
+        if (entry.confidence >= confident) {
+            for (int i = 0; i < params.degree; i++) {
+                out.push_back(block + entry.stride * (params.distance + i));
+            }
+        }
+    }
+
+   private:
+    struct Entry {
+        std::int64_t region = -1;
+        std::int64_t last_block = 0;
+        std::int64_t stride = 0;
+        int confidence = 0;
+    };
+
+    Params params;
+    int region_shift;
+    std::array< Entry, table_size > table = {};
+};
+
+class Stream {
+   public:
+    static constexpr const char* name = "stream";
+    static constexpr int n_streams = 16;
+    static constexpr std::int64_t window = 8;  // blocks
+
+    explicit Stream(Params params_) : params(params_) {}
+
+    void train(std::int64_t block, bool miss,
+               std::vector< std::int64_t >& out) {
+        if (!miss) {
+            return;
+        }
+        tick++;
+        for (auto& s : streams) {
+            if (s.last_used == 0) {
+                continue;
+            }
+            const std::int64_t delta = block - s.head;
+            if (delta == 0 || std::abs(delta) > window) {
+                continue;
+            }
+            const int direction = delta > 0 ? 1 : -1;
+            s.confirmed = s.direction == direction;
+            s.direction = direction;
+            s.head = block;
+            s.last_used = tick;
+            if (s.confirmed) {
+                for (int i = 0; i < params.degree; i++) {
+                    out.push_back(block + direction * (params.distance + i));
+                }
+            }
+            return;
+        }
+        // no stream nearby, replace the least recently used one
+        auto& victim = *std::min_element(
+            streams.begin(), streams.end(),
+            [](const Entry& a, const Entry& b) {
+                return a.last_used < b.last_used;
+            });
+        victim = Entry{block, 0, false, tick};
+    }
+
+   private:
+    struct Entry {
+        std::int64_t head = 0;
+        int direction = 0;
+        bool confirmed = false;
+        std::uint64_t last_used = 0;
+    };
+
+    Params params;
+    std::uint64_t tick = 0;
+    std::array< Entry, n_streams > streams = {};
+};
+
+class RecentBlocks {
+    // the last `capacity` distinct blocks inserted, O(1) membership test
+   public:
+    explicit RecentBlocks(std::size_t capacity_) : capacity(capacity_) {}
+
+    void insert(std::int64_t block) {
+        if (!members.insert(block).second) {
+            return;
+        }
+        order.push_back(block);
+        if (order.size() > capacity) {
+            members.erase(order.front());
+            order.pop_front();
+        }
+    }
+
+    // removes the block, returns whether it was there
+    bool take(std::int64_t block) { return members.erase(block) != 0; }
+
+   private:
+    std::size_t capacity;
+    std::deque< std::int64_t > order;  // may hold already taken blocks
+    std::unordered_set< std::int64_t > members;
+};
+
+struct Stats {
+    std::uint64_t issued = 0;     // prefetches that filled a block
+    std::uint64_t redundant = 0;  // proposals already cached, dropped
+    std::uint64_t useful = 0;     // prefetched blocks later demanded
+    std::uint64_t unused = 0;     // prefetched blocks evicted before use
+    std::uint64_t lead_sum = 0;   // demand accesses from fill to first use
+    std::uint64_t demand_misses = 0;  // at the prefetch level
+    std::uint64_t polluted_misses = 0;
+    std::uint64_t writebacks = 0;  // memory writes caused by prefetch fills
+};
+
+class Engine {
+   public:
+    using prefetcher_type = std::variant< NextLine, Stride, Stream >;
+
+    Engine(const std::string& kind, int level_, Params params,
+           int offset_size, std::size_t level_capacity)
+        : level(level_),
+          prefetcher(make(kind, params, offset_size)),
+          displaced(level_capacity) {
+        if (level != 1 && level != 2) {
+            throw std::invalid_argument("prefetch level must be 1 or 2");
+        }
+        if (params.degree < 1 || params.distance < 1) {
+            throw std::invalid_argument(
+                "prefetch degree and distance must be positive");
+        }
+    }
+
+    // a demand reference reached the prefetch level, collect proposals
+    const std::vector< std::int64_t >& train(std::int64_t block, bool miss) {
+        now++;
+        proposals.clear();
+        if (miss) {
+            stats.demand_misses++;
+            if (displaced.take(block)) {
+                stats.polluted_misses++;
+            }
+        }
+        std::visit([&](auto& p) { p.train(block, miss, proposals); },
+                   prefetcher);
+        return proposals;
+    }
+
+    void on_issued(std::int64_t block) {
+        stats.issued++;
+        outstanding[block] = now;
+    }
+
+    void on_useful(std::int64_t block) {
+        stats.useful++;
+        const auto found = outstanding.find(block);
+        if (found != outstanding.end()) {
+            stats.lead_sum += now - found->second;
+            outstanding.erase(found);
+        }
+    }
+
+    void on_unused_eviction(std::int64_t block) {
+        stats.unused++;
+        outstanding.erase(block);
+    }
+
+    // `block` was pushed out of the prefetch level to make room
+    void on_displaced(std::int64_t block) { displaced.insert(block); }
+
+    void report(std::ostream& out) const {
+        const auto ratio = [](double a, double b) { return b > 0 ? a / b : 0; };
+        out << "prefetch L" << level << " "
+            << std::visit([](const auto& p) { return p.name; }, prefetcher)
+            << ": " << stats.issued << " issued, " << stats.redundant
+            << " redundant, " << stats.useful << " useful, " << stats.unused
+            << " evicted unused, " << stats.writebacks << " writebacks\n";
+        out << "  accuracy " << ratio(stats.useful, stats.issued)
+            << ", coverage "
+            << ratio(stats.useful, stats.useful + stats.demand_misses)
+            << ", avg lead " << ratio(stats.lead_sum, stats.useful)
+            << " accesses, pollution " << stats.polluted_misses
+            << " misses\n";
+    }
+
+    int level;
+    Stats stats;
+
+   private:
+    static prefetcher_type make(const std::string& kind, Params params,
+                                int offset_size) {
+        if (kind == NextLine::name) return NextLine(params);
+        if (kind == Stride::name) return Stride(params, offset_size);
+        if (kind == Stream::name) return Stream(params);
+        throw std::invalid_argument("unknown prefetcher: " + kind);
+    }
+
+    prefetcher_type prefetcher;
+    std::vector< std::int64_t > proposals;
+    std::unordered_map< std::int64_t, std::uint64_t > outstanding;
+    RecentBlocks displaced;
+    std::uint64_t now = 0;
+};
+
+}  // namespace prefetch
+
+#endif
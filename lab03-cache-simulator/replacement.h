@@ -0,0 +1,271 @@
+/* Cache replacement policies
+
+Each policy keeps the replacement state of one cache set and is used as a
+template parameter of CacheSet, so the choice is made once at startup and the
+simulation loop calls the policy directly.
+
+Interface:
+- Policy(int ways)
+- void on_hit(int way)    the block in `way` was accessed
+- void on_fill(int way)   a new block was placed into `way`
+- int victim()            the way to evict from a full set
+- serialize(ar)           pass the state to a snapshot archive (snapshot.h)
+
+Policies:
+- roundrobin   rotating pointer, ignores hits and fills (the lab's original)
+- fifo         evict the way filled the longest time ago
+- lru          evict the least recently used way
+- plru         tree pseudo-LRU, needs a power-of-two number of ways
+- srrip        static re-reference interval prediction, 2-bit RRPV
+- brrip        bimodal RRIP, inserts at distant re-reference most of the time
+- random       evict a uniformly random way
+*/
+
+#ifndef REPLACEMENT_H_
+#define REPLACEMENT_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace replacement {
+
+class XorShift32 {
+    // small deterministic generator, results are reproducible across runs
+   public:
+    std::uint32_t operator()() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    template < typename Archive >
+    void serialize(Archive& ar) {
+        ar(state);
+    }
+
+   private:
+    std::uint32_t state = 2463534242U;
+};
+
+class RoundRobin {
+   public:
+    static constexpr const char* name = "roundrobin";
+
+    explicit RoundRobin(int ways_) : ways(ways_) {}
+
+    void on_hit(int) {}
+    void on_fill(int) {}
+
+    int victim() {
+        const auto copied_eviction_ptr = eviction_ptr;
+        eviction_ptr = (eviction_ptr + 1) % ways;
+        return copied_eviction_ptr;
+    }
+
+    template < typename Archive >
+    void serialize(Archive& ar) {
+        ar(eviction_ptr);
+    }
+
+    int eviction_ptr = 0;
+
+   private:
+    int ways;
+};
+
+class Fifo {
+   public:
+    static constexpr const char* name = "fifo";
+
+    explicit Fifo(int ways_) : filled_at(ways_, 0) {}
+
+    void on_hit(int) {}
+    void on_fill(int way) { filled_at[way] = ++clock; }
+
+    int victim() {
+        return std::min_element(filled_at.cbegin(), filled_at.cend()) -
+               filled_at.cbegin();
+    }
+
+    template < typename Archive >
+    void serialize(Archive& ar) {
+        ar(filled_at);
+        ar(clock);
+    }
+
+    std::vector< std::uint64_t > filled_at;
+    std::uint64_t clock = 0;
+};
+
+class Lru {
+   public:
+    static constexpr const char* name = "lru";
+
+    explicit Lru(int ways_) : used_at(ways_, 0) {}
+
+    void on_hit(int way) { used_at[way] = ++clock; }
+    void on_fill(int way) { used_at[way] = ++clock; }
+
+    int victim() {
+        return std::min_element(used_at.cbegin(), used_at.cend()) -
+               used_at.cbegin();
+    }
+
+    template < typename Archive >
+    void serialize(Archive& ar) {
+        ar(used_at);
+        ar(clock);
+    }
+
+    std::vector< std::uint64_t > used_at;
+    std::uint64_t clock = 0;
+};
+
+class TreePlru {
+    /*
+     * binary tree over the ways, stored heap-style in `bits`
+     *   - node i has children 2i+1 and 2i+2, leaves are the ways
+     *   - a node bit of 0 points the victim search left, 1 points it right
+     *   - an access flips the bits on its path to point away from it
+     */
+   public:
+    static constexpr const char* name = "plru";
+
+    explicit TreePlru(int ways_) : ways(ways_), bits(std::max(ways_ - 1, 0)) {
+        if (ways <= 0 || (ways & (ways - 1)) != 0) {
+            throw std::invalid_argument(
+                "plru needs a power-of-two associativity");
+        }
+    }
+
+    void on_hit(int way) { touch(way); }
+    void on_fill(int way) { touch(way); }
+
+    int victim() {
+        int node = 0;
+        while (node < ways - 1) {
+            node = 2 * node + 1 + bits[node];
+        }
+        return node - (ways - 1);
+    }
+
+    template < typename Archive >
+    void serialize(Archive& ar) {
+        ar(bits);
+    }
+
+    int ways;
+    std::vector< std::uint8_t > bits;
+
+   private:
+    void touch(int way) {
+        int node = way + ways - 1;
+        while (node > 0) {
+            const int parent = (node - 1) / 2;
+            // point the parent at the sibling subtree
+            bits[parent] = (node == 2 * parent + 1) ? 1 : 0;
+            node = parent;
+        }
+    }
+};
+
+template < bool Bimodal >
+class Rrip {
+    /*
+     * re-reference prediction values (RRPV), 2 bits per way
+     *   - hit: predict near-immediate re-reference (0)
+     *   - fill: SRRIP predicts long (max - 1), BRRIP predicts distant (max)
+     *     except for one fill in `bimodal_throttle`
+     *   - victim: first way predicted distant, aging every way until found
+     */
+   public:
+    static constexpr const char* name = Bimodal ? "brrip" : "srrip";
+    static constexpr std::uint8_t max_rrpv = 3;
+    static constexpr std::uint32_t bimodal_throttle = 32;
+
+    explicit Rrip(int ways_) : rrpv(ways_, max_rrpv) {}
+
+    void on_hit(int way) { rrpv[way] = 0; }
+
+    void on_fill(int way) {
+        if (Bimodal && rng() % bimodal_throttle != 0) {
+            rrpv[way] = max_rrpv;
+        } else {
+            rrpv[way] = max_rrpv - 1;
+        }
+    }
+
+    int victim() {
+        while (true) {
+            const auto found =
+                std::find(rrpv.cbegin(), rrpv.cend(), max_rrpv);
+            if (found != rrpv.cend()) {
+                return found - rrpv.cbegin();
+            }
+            for (auto& v : rrpv) {
+                v++;
+            }
+        }
+    }
+
+    template < typename Archive >
+    void serialize(Archive& ar) {
+        ar(rrpv);
+        ar(rng);
+    }
+
+    std::vector< std::uint8_t > rrpv;
+    XorShift32 rng;
+};
+
+using Srrip = Rrip< false >;
+using Brrip = Rrip< true >;
+
+class Random {
+   public:
+    static constexpr const char* name = "random";
+
+    explicit Random(int ways_) : ways(ways_) {}
+
+    void on_hit(int) {}
+    void on_fill(int) {}
+
+    int victim() { return rng() % ways; }
+
+    template < typename Archive >
+    void serialize(Archive& ar) {
+        ar(rng);
+    }
+
+    int ways;
+    XorShift32 rng;
+};
+
+template < typename T >
+struct type_tag {
+    using type = T;
+};
+
+template < typename F >
+auto with_policy(const std::string& name, F&& f) {
+    /*
+     * calls f(type_tag< Policy >{}) with the policy called `name`, which
+     * instantiates whatever f does once per policy
+     */
+    if (name == RoundRobin::name) return f(type_tag< RoundRobin >{});
+    if (name == Fifo::name) return f(type_tag< Fifo >{});
+    if (name == Lru::name) return f(type_tag< Lru >{});
+    if (name == TreePlru::name) return f(type_tag< TreePlru >{});
+    if (name == Srrip::name) return f(type_tag< Srrip >{});
+    if (name == Brrip::name) return f(type_tag< Brrip >{});
+    if (name == Random::name) return f(type_tag< Random >{});
+    throw std::invalid_argument("unknown replacement policy: " + name);
+}
+
+}  // namespace replacement
+
+#endif
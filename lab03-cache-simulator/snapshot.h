@@ -0,0 +1,190 @@
+/* Cache state snapshots
+
+A snapshot holds the contents of both cache levels after a run (tag, valid,
+dirty and prefetched bits of every block) together with the replacement
+policy state of every set, so a measurement run can start from a warm cache
+instead of replaying the warm-up trace.
+
+State is written through an archive: every stateful type has
+    template < typename Archive > void serialize(Archive& ar)
+that passes its members to ar(...), so the same function both saves
+(Writer) and restores (Reader). Integers are stored little-endian, vectors
+as their length followed by the elements.
+
+File layout:
+- magic "CSNP" and a format version
+- replacement policy name
+- block size, associativity and size in KiB of L1 and L2
+- L1 sets, then L2 sets
+A snapshot only loads into a run with the same policy and geometry.
+
+The Reader checks every read and bounds every stored length by the bytes
+left in the file (each element takes at least one), so a truncated or
+corrupt file is an invalid_argument ("corrupt snapshot") rather than a huge
+allocation or zero-filled state.
+*/
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace snapshot {
+
+constexpr std::array< char, 4 > magic = {'C', 'S', 'N', 'P'};
+constexpr std::uint32_t version = 1;
+
+class Writer {
+   public:
+    explicit Writer(const std::string& filename)
+        : out(filename, std::ios::binary) {
+        if (!out.is_open()) {
+            throw std::runtime_error("cannot open " + filename);
+        }
+        out.write(magic.data(), magic.size());
+        std::uint32_t v = version;
+        (*this)(v);
+    }
+
+    template < typename T >
+    void operator()(const T& value) {
+        if constexpr (std::is_integral_v< T >) {
+            for (std::size_t i = 0; i < sizeof(T); i++) {
+                out.put(static_cast< char >(
+                    (static_cast< std::uint64_t >(value) >> (8 * i)) & 0xff));
+            }
+        } else {
+            // serialize() both saves and loads, so it can't be const
+            const_cast< T& >(value).serialize(*this);
+        }
+    }
+
+    void operator()(const std::string& value) {
+        (*this)(static_cast< std::uint64_t >(value.size()));
+        out.write(value.data(), value.size());
+    }
+
+    template < typename T >
+    void operator()(const std::vector< T >& values) {
+        (*this)(static_cast< std::uint64_t >(values.size()));
+        for (const auto& value : values) {
+            (*this)(value);
+        }
+    }
+
+    template < typename T, std::size_t N >
+    void operator()(const std::array< T, N >& values) {
+        for (const auto& value : values) {
+            (*this)(value);
+        }
+    }
+
+   private:
+    std::ofstream out;
+};
+
+class Reader {
+   public:
+    explicit Reader(const std::string& filename_)
+        : in(filename_, std::ios::binary), filename(filename_) {
+        if (!in.is_open()) {
+            throw std::invalid_argument("cannot open " + filename);
+        }
+        in.seekg(0, std::ios::end);
+        remaining = in.tellg();
+        in.seekg(0);
+        std::array< char, 4 > found = {};
+        in.read(found.data(), found.size());
+        if (!in || found != magic) {
+            throw std::invalid_argument(filename + " is not a cache snapshot");
+        }
+        remaining -= found.size();
+        std::uint32_t v;
+        (*this)(v);
+        if (v != version) {
+            throw std::invalid_argument(filename +
+                                        ": unsupported snapshot version");
+        }
+    }
+
+    template < typename T >
+    void operator()(T& value) {
+        if constexpr (std::is_integral_v< T >) {
+            std::uint64_t raw = 0;
+            for (std::size_t i = 0; i < sizeof(T); i++) {
+                const int byte = in.get();
+                if (byte == EOF) {
+                    corrupt("truncated");
+                }
+                raw |= static_cast< std::uint64_t >(byte) << (8 * i);
+            }
+            remaining -= sizeof(T);
+            value = static_cast< T >(raw);
+        } else {
+            value.serialize(*this);
+        }
+    }
+
+    void operator()(std::string& value) {
+        value.resize(length());
+        if (!in.read(value.data(), value.size())) {
+            corrupt("truncated");
+        }
+        remaining -= value.size();
+    }
+
+    template < typename T >
+    void operator()(std::vector< T >& values) {
+        values.resize(length());
+        for (auto& value : values) {
+            (*this)(value);
+        }
+    }
+
+    template < typename T, std::size_t N >
+    void operator()(std::array< T, N >& values) {
+        for (auto& value : values) {
+            (*this)(value);
+        }
+    }
+
+    // loaded state must match the running config
+    template < typename T >
+    void expect(const T& expected, const char* what) {
+        T value;
+        (*this)(value);
+        if (value != expected) {
+            throw std::invalid_argument(
+                std::string("snapshot was taken with a different ") + what);
+        }
+    }
+
+   private:
+    std::uint64_t length() {
+        std::uint64_t n;
+        (*this)(n);
+        if (n > remaining) {
+            corrupt("a length of " + std::to_string(n) + " with " +
+                    std::to_string(remaining) + " bytes left");
+        }
+        return n;
+    }
+
+    [[noreturn]] void corrupt(const std::string& why) const {
+        throw std::invalid_argument(filename + ": corrupt snapshot, " + why);
+    }
+
+    std::ifstream in;
+    std::string filename;
+    std::uint64_t remaining = 0;  // bytes left in the file
+};
+
+}  // namespace snapshot
+
+#endif
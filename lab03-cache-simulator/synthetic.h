@@ -0,0 +1,180 @@
+/* Synthetic access streams
+
+Generated in memory for benchmarking the simulator itself, so a measurement
+is not bounded by trace parsing or disk. Every stream is deterministic for a
+given seed and spans a footprint well beyond the largest L2 we configure:
+- sequential      word after word through the footprint, every 4th a write
+- strided         one access per 256 bytes, wrapping around
+- uniform         random words, uniformly over the footprint
+- zipf            blocks drawn from a Zipf(0.99) popularity, hot blocks
+                  scattered over the footprint
+- pointer_chase   reads following a random cyclic permutation of 64-byte
+                  nodes, no spatial locality at all
+- stack           like trace.txt: pushes and pops around a wandering stack
+                  pointer near 0xbf980000, mixed with heap accesses that
+                  stay local for a while
+*/
+
+#ifndef SYNTHETIC_H_
+#define SYNTHETIC_H_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace synthetic {
+
+enum class pattern { sequential, strided, uniform, zipf, pointer_chase, stack };
+
+constexpr std::array< pattern, 6 > patterns = {
+    pattern::sequential, pattern::strided,       pattern::uniform,
+    pattern::zipf,       pattern::pointer_chase, pattern::stack};
+
+constexpr std::array< const char*, 6 > pattern_names = {
+    "sequential", "strided", "uniform", "zipf", "pointer_chase", "stack"};
+
+inline const char* name(pattern p) {
+    return pattern_names[static_cast< int >(p)];
+}
+
+struct Access {
+    char type;  // 'R' or 'W'
+    unsigned addr;
+};
+
+constexpr unsigned footprint = 4 << 20;  // bytes
+constexpr unsigned heap_base = 0x10000000;
+constexpr unsigned node_size = 64;
+
+class Generator {
+   public:
+    explicit Generator(std::uint64_t seed) : rng(seed) {}
+
+    std::vector< Access > generate(pattern p, std::size_t n) {
+        std::vector< Access > out;
+        out.reserve(n);
+        switch (p) {
+            case pattern::sequential:
+                for (std::size_t i = 0; i < n; i++) {
+                    out.push_back({i % 4 == 3 ? 'W' : 'R',
+                                   heap_base + unsigned(i * 4 % footprint)});
+                }
+                break;
+            case pattern::strided:
+                for (std::size_t i = 0; i < n; i++) {
+                    out.push_back({i % 4 == 3 ? 'W' : 'R',
+                                   heap_base + unsigned(i * 256 % footprint)});
+                }
+                break;
+            case pattern::uniform:
+                for (std::size_t i = 0; i < n; i++) {
+                    out.push_back(
+                        {type(), heap_base + below(footprint) / 4 * 4});
+                }
+                break;
+            case pattern::zipf:
+                zipf(out, n);
+                break;
+            case pattern::pointer_chase:
+                pointer_chase(out, n);
+                break;
+            case pattern::stack:
+                stack(out, n);
+                break;
+        }
+        return out;
+    }
+
+   private:
+    // 3 reads to 1 write
+    char type() { return below(4) == 3 ? 'W' : 'R'; }
+
+    unsigned below(unsigned bound) {
+        // plain modulo keeps the streams identical across standard libraries
+        return static_cast< unsigned >(rng() % bound);
+    }
+
+    void zipf(std::vector< Access >& out, std::size_t n) {
+        constexpr unsigned blocks = footprint / node_size;
+        std::vector< double > cdf(blocks);
+        double sum = 0;
+        for (unsigned k = 0; k < blocks; k++) {
+            sum += 1 / std::pow(k + 1, 0.99);
+            cdf[k] = sum;
+        }
+        for (std::size_t i = 0; i < n; i++) {
+            const double u = (rng() >> 11) * 0x1.0p-53 * sum;
+            const unsigned rank =
+                std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+            // an odd multiplier permutes the ranks over the footprint
+            const unsigned block = (rank * 2654435761U) % blocks;
+            out.push_back({type(), heap_base + block * node_size +
+                                       below(node_size) / 4 * 4});
+        }
+    }
+
+    void pointer_chase(std::vector< Access >& out, std::size_t n) {
+        constexpr unsigned nodes = footprint / node_size;
+        // Sattolo's algorithm, a single cycle through all nodes
+        std::vector< unsigned > next(nodes);
+        for (unsigned i = 0; i < nodes; i++) {
+            next[i] = i;
+        }
+        for (unsigned i = nodes - 1; i > 0; i--) {
+            std::swap(next[i], next[below(i)]);
+        }
+        unsigned node = 0;
+        for (std::size_t i = 0; i < n; i++) {
+            out.push_back({'R', heap_base + node * node_size});
+            node = next[node];
+        }
+    }
+
+    void stack(std::vector< Access >& out, std::size_t n) {
+        constexpr unsigned stack_top = 0xbf980000;
+        constexpr unsigned max_depth = 64 << 10;  // bytes
+        constexpr unsigned heap_span = 256 << 10;
+        unsigned sp = stack_top - 0x200;
+        unsigned heap = heap_base;
+        while (out.size() < n) {
+            const unsigned roll = below(100);
+            if (roll < 15) {
+                // call: a frame of 1 to 8 saved words
+                const unsigned words = 1 + below(8);
+                for (unsigned w = 0; w < words && sp > stack_top - max_depth;
+                     w++) {
+                    sp -= 4;
+                    out.push_back({'W', sp});
+                }
+            } else if (roll < 30) {
+                // return: reload what the frame saved
+                const unsigned words = 1 + below(8);
+                for (unsigned w = 0; w < words && sp < stack_top; w++) {
+                    out.push_back({'R', sp});
+                    sp += 4;
+                }
+            } else if (roll < 70) {
+                // locals near the top of the stack
+                out.push_back({type(), sp + below(64) / 4 * 4});
+            } else {
+                if (below(50) == 0) {
+                    heap = heap_base + below(heap_span) / 4 * 4;
+                }
+                heap = heap_base + (heap - heap_base + 4 * below(16)) %
+                                       heap_span;
+                out.push_back({type(), heap});
+            }
+        }
+        out.resize(n);
+    }
+
+    std::mt19937_64 rng;
+};
+
+}  // namespace synthetic
+
+#endif
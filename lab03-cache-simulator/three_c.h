@@ -0,0 +1,174 @@
+/* 3C miss classification
+
+Every miss of a cache level is put into one of three classes:
+- compulsory   first reference to the block at this level
+- capacity     a fully-associative LRU cache with the same number of blocks
+               would have missed as well
+- conflict     the fully-associative cache would have hit, so the miss is
+               caused by the set mapping (more associativity helps)
+
+A level's references are what reaches it: every access for L1, and only the
+L1 misses for L2. The shadow cache and the first-touch set follow what the
+level allocates, not what it is asked for:
+- L1 allocates on read misses only (write-no-allocate)
+- the exclusive L2 is filled by L1 victims, and gives a block up to L1 on a
+  read hit; its misses allocate nothing
+So a block written before it is ever read is still a compulsory miss on
+that first read.
+
+Both helper structures are hash-indexed, so each access costs O(1) on top of
+the simulation:
+- the first-touch set of block addresses seen at the level
+- the shadow fully-associative LRU cache, a list in recency order plus a hash
+  map from block address to its list node
+*/
+
+#ifndef THREE_C_H_
+#define THREE_C_H_
+
+#include <array>
+#include <cstdint>
+#include <iomanip>
+#include <list>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace three_c {
+
+enum miss_kind { compulsory = 0, capacity = 1, conflict = 2 };
+
+constexpr std::array< const char*, 3 > miss_kind_names = {
+    "compulsory", "capacity", "conflict"};
+
+class ShadowLru {
+   public:
+    explicit ShadowLru(std::size_t capacity_) : capacity(capacity_) {
+        where.reserve(capacity + 1);
+    }
+    // `where` points into `recency`, which a copy would not carry over
+    ShadowLru(const ShadowLru&) = delete;
+    ShadowLru(ShadowLru&&) = default;
+
+    bool contains(std::uint64_t block) const {
+        return where.count(block) != 0;
+    }
+
+    // returns whether the block was cached, then makes it most recent
+    bool access(std::uint64_t block) {
+        const auto found = where.find(block);
+        if (found != where.end()) {
+            recency.splice(recency.begin(), recency, found->second);
+            return true;
+        }
+        recency.push_front(block);
+        where.emplace(block, recency.begin());
+        if (recency.size() > capacity) {
+            where.erase(recency.back());
+            recency.pop_back();
+        }
+        return false;
+    }
+
+    void erase(std::uint64_t block) {
+        const auto found = where.find(block);
+        if (found != where.end()) {
+            recency.erase(found->second);
+            where.erase(found);
+        }
+    }
+
+   private:
+    std::size_t capacity;
+    std::list< std::uint64_t > recency;
+    std::unordered_map< std::uint64_t, std::list< std::uint64_t >::iterator >
+        where;
+};
+
+class LevelClassifier {
+   public:
+    using counts = std::array< std::uint64_t, 3 >;
+
+    LevelClassifier(std::size_t capacity_blocks, std::size_t num_sets)
+        : shadow(capacity_blocks), per_set(num_sets, counts{}) {}
+
+    /*
+     * what the level does with a block once it is referenced, for the shadow
+     * cache to do the same
+     */
+    enum effect {
+        allocate,  // cached and most recent afterwards
+        bypass,    // no fill on a miss; a hit only makes it most recent
+        give_up    // not cached afterwards (the exclusive L2 on a read)
+    };
+
+    // every reference reaching this level goes through here, hit or miss;
+    // the miss is classified on the state before the reference
+    void access(std::uint64_t block, unsigned set, bool missed, effect e) {
+        references++;
+        if (missed) {
+            const miss_kind kind = touched.count(block) == 0 ? compulsory
+                                   : shadow.contains(block)  ? conflict
+                                                             : capacity;
+            totals[kind]++;
+            per_set[set][kind]++;
+        }
+        if (e == give_up) {
+            shadow.erase(block);
+        } else if (e == allocate || shadow.contains(block)) {
+            fill(block);
+        }
+    }
+
+    // a block placed into the level outside of a reference to it
+    void fill(std::uint64_t block) {
+        touched.insert(block);
+        shadow.access(block);
+    }
+
+    // a block taken out of the level outside of a reference to it
+    void drop(std::uint64_t block) { shadow.erase(block); }
+
+    std::uint64_t misses() const {
+        return totals[compulsory] + totals[capacity] + totals[conflict];
+    }
+
+    void report_totals(std::ostream& out, const std::string& level) const {
+        out << level << ": " << references << " references, " << misses()
+            << " misses";
+        for (int kind = 0; kind < 3; kind++) {
+            out << ", " << totals[kind] << " " << miss_kind_names[kind];
+        }
+        out << '\n';
+    }
+
+    void report_sets(std::ostream& out, const std::string& level) const {
+        // sets without any miss are left out
+        out << std::setw(level.size() + 4) << level + " set" << std::setw(12)
+            << "compulsory" << std::setw(12) << "capacity" << std::setw(12)
+            << "conflict" << '\n';
+        for (std::size_t set = 0; set < per_set.size(); set++) {
+            const auto& c = per_set[set];
+            if (c[compulsory] + c[capacity] + c[conflict] == 0) {
+                continue;
+            }
+            out << std::setw(level.size() + 4) << set << std::setw(12)
+                << c[compulsory] << std::setw(12) << c[capacity]
+                << std::setw(12) << c[conflict] << '\n';
+        }
+    }
+
+    counts totals = {};
+    std::uint64_t references = 0;
+
+   private:
+    std::unordered_set< std::uint64_t > touched;
+    ShadowLru shadow;
+    std::vector< counts > per_set;
+};
+
+}  // namespace three_c
+
+#endif
@@ -0,0 +1,213 @@
+/* Per-window time series and phase detection
+
+Whole-trace rates hide bursts, so the run is cut into windows of a fixed
+number of accesses and every window gets one row:
+- L1 hit rate, L2 hit rate (of the accesses reaching L2), miss rate (accesses
+  reaching memory) and writeback rate (accesses writing memory)
+- working-set size, the distinct L1 blocks touched in the window
+
+Phases are detected from working-set signatures: every block sets one bit of
+a 1024-bit vector, picked by a hash of its address. Two windows are compared
+by their relative signature distance
+    |A xor B| / |A or B|
+which is 0 for the same working set and 1 for disjoint ones. A window closer
+than `threshold` to a phase seen before (its first window's signature) is in
+that phase again, otherwise it starts a new one. Recurring phases thus keep
+their number. The phase table holds at most max_phases signatures, so a
+window is matched in bounded time however noisy the trace; once it is full,
+a window far from every phase joins the nearest one instead (counted as
+merged).
+
+Output, by file name:
+- "*.bin"   binary, little-endian: magic "CTSS", format version (1), window
+            size, all 4 bytes; then 36-byte records: first access (8 bytes),
+            accesses, L1 hits, L2 hits, memory reads, memory writes,
+            working-set size (4 bytes each), phase (2 bytes), distance to the
+            previous window in 1/10000 (2 bytes)
+- else      CSV with a header row
+*/
+
+#ifndef TIMESERIES_H_
+#define TIMESERIES_H_
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace timeseries {
+
+constexpr std::array< char, 4 > magic = {'C', 'T', 'S', 'S'};
+constexpr std::uint32_t version = 1;
+constexpr std::size_t signature_bits = 1024;
+constexpr std::size_t max_phases = 256;
+static_assert(max_phases <= 1 << 16, "phase numbers are 2 bytes in .bin");
+
+using Signature = std::bitset< signature_bits >;
+
+inline double distance(const Signature& a, const Signature& b) {
+    const auto either = (a | b).count();
+    return either ? double((a ^ b).count()) / either : 0;
+}
+
+struct Window {
+    std::uint64_t first = 0;  // index of the window's first access
+    std::uint32_t accesses = 0;
+    std::uint32_t l1_hits = 0;
+    std::uint32_t l2_hits = 0;
+    std::uint32_t mem_reads = 0;  // missed both levels
+    std::uint32_t mem_writes = 0;
+    std::uint32_t working_set = 0;
+    std::uint32_t phase = 0;
+    double distance = 0;  // to the previous window's signature
+};
+
+class Recorder {
+   public:
+    Recorder(const std::string& filename, std::uint64_t window_,
+             int block_bits_, double threshold_)
+        : out(filename, std::ios::binary),
+          binary(filename.size() >= 4 &&
+                 filename.compare(filename.size() - 4, 4, ".bin") == 0),
+          window(window_),
+          block_bits(block_bits_),
+          threshold(threshold_) {
+        if (!out.is_open()) {
+            throw std::runtime_error("cannot open " + filename);
+        }
+        if (window == 0 || window > UINT32_MAX) {
+            throw std::invalid_argument("bad time series window size");
+        }
+        if (binary) {
+            out.write(magic.data(), magic.size());
+            put(version, 4);
+            put(window, 4);
+        } else {
+            out << "window,first_access,accesses,l1_hit_rate,l2_hit_rate,"
+                   "miss_rate,writeback_rate,working_set,distance,phase\n";
+        }
+    }
+
+    // one access and its outcome
+    void access(unsigned addr, bool l1_hit, bool l2_hit, bool mem_write) {
+        const std::uint64_t block = addr >> block_bits;
+        if (blocks.insert(block).second) {
+            // Fibonacci hashing, the top bits pick the signature bit
+            signature.set((block * 0x9e3779b97f4a7c15ULL) >> 54);
+        }
+        current.accesses++;
+        current.l1_hits += l1_hit;
+        current.l2_hits += !l1_hit && l2_hit;
+        current.mem_reads += !l1_hit && !l2_hit;
+        current.mem_writes += mem_write;
+        if (current.accesses == window) {
+            close();
+        }
+    }
+
+    // flush the last, partial window
+    void finish() {
+        if (current.accesses > 0) {
+            close();
+        }
+        out.close();
+    }
+
+    std::uint64_t windows = 0;
+    std::uint64_t phase_changes = 0;
+    std::uint64_t merged = 0;  // windows put into the nearest phase, the
+                               // table being full
+    std::vector< Signature > phases;  // first signature of every phase
+
+   private:
+    void close() {
+        current.working_set = blocks.size();
+        current.distance = windows ? distance(signature, previous) : 0;
+
+        std::size_t best = phases.size();
+        std::size_t nearest = 0;
+        double best_distance = threshold;
+        double nearest_distance = 2;
+        for (std::size_t i = 0; i < phases.size(); i++) {
+            const auto d = distance(signature, phases[i]);
+            if (d < best_distance) {
+                best = i;
+                best_distance = d;
+            }
+            if (d < nearest_distance) {
+                nearest = i;
+                nearest_distance = d;
+            }
+        }
+        if (best == phases.size()) {
+            if (phases.size() < max_phases) {
+                phases.push_back(signature);
+            } else {
+                best = nearest;
+                merged++;
+            }
+        }
+        if (windows > 0 && best != last_phase) {
+            phase_changes++;
+        }
+        current.phase = best;
+        last_phase = best;
+
+        write(current);
+        windows++;
+        previous = signature;
+        signature.reset();
+        blocks.clear();
+        current = Window{};
+        current.first = windows * window;
+    }
+
+    void write(const Window& w) {
+        if (binary) {
+            put(w.first, 8);
+            put(w.accesses, 4);
+            put(w.l1_hits, 4);
+            put(w.l2_hits, 4);
+            put(w.mem_reads, 4);
+            put(w.mem_writes, 4);
+            put(w.working_set, 4);
+            put(w.phase, 2);
+            put(static_cast< std::uint64_t >(w.distance * 10000 + 0.5), 2);
+            return;
+        }
+        const double n = w.accesses;
+        const auto l2_refs = w.accesses - w.l1_hits;
+        out << windows << ',' << w.first << ',' << w.accesses << ','
+            << w.l1_hits / n << ','
+            << (l2_refs ? double(w.l2_hits) / l2_refs : 0) << ','
+            << w.mem_reads / n << ',' << w.mem_writes / n << ','
+            << w.working_set << ',' << std::setprecision(4) << w.distance
+            << std::setprecision(6) << ',' << w.phase << '\n';
+    }
+
+    void put(std::uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            out.put(static_cast< char >((value >> (8 * i)) & 0xff));
+        }
+    }
+
+    std::ofstream out;
+    bool binary;
+    std::uint64_t window;
+    int block_bits;
+    double threshold;
+    Window current;
+    std::unordered_set< std::uint64_t > blocks;
+    Signature signature;
+    Signature previous;
+    std::size_t last_phase = 0;
+};
+
+}  // namespace timeseries
+
+#endif
@@ -1,12 +1,32 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
 #include <bitset>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "inverted.h"
+#include "layout.h"
+#include "paging.h"
+#include "tlb.h"
+
 #ifdef DEBUG
 #include "../debug.h"
 #else
@@ -75,32 +95,131 @@ constexpr const int MemSize = 65536;
 
 constexpr long bitmask(unsigned n) { return (1UL << n) - 1; }
 
-class PhysicalMemory {
+class MappedFile {
+    /*
+     * a whole file mapped into memory, copy-on-write: writes to data()
+     * stay private to the process
+     */
    public:
-    PhysicalMemory() {
-        DMem.resize(MemSize);
-        ifstream dmem;
-        string line;
-        int i = 0;
-        dmem.open("pt_initialize.txt");
-        if (dmem.is_open()) {
-            while (getline(dmem, line)) {
-                DMem[i] = bitset< 8 >(line);
-                i++;
+    explicit MappedFile(const string& filename) {
+        const int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            opened = true;
+            length = st.st_size;
+        }
+        if (opened && length > 0) {
+            void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                opened = false;
+                length = 0;
+            } else {
+                bytes = static_cast< std::uint8_t* >(p);
             }
-        } else
+        }
+        close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (bytes != nullptr) {
+            munmap(bytes, length);
+        }
+    }
+
+    bool is_open() const { return opened; }
+    std::uint8_t* data() const { return bytes; }
+    std::size_t size() const { return length; }
+
+   private:
+    bool opened = false;
+    std::uint8_t* bytes = nullptr;
+    std::size_t length = 0;
+};
+
+bool is_binary_file(const string& filename) {
+    return filename.size() >= 4 &&
+           filename.compare(filename.size() - 4, 4, ".bin") == 0;
+}
+
+class PhysicalMemory {
+    /*
+     * the page tables' memory, 4096 addressable bytes, from an image file:
+     * - "*.bin"   raw bytes, mapped into memory as they are
+     * - else      one byte per line in binary, like pt_initialize.txt
+     * Words are read big-endian straight from the bytes; the few bytes a
+     * word near the end may need beyond a short image read as zero.
+     */
+   public:
+    static constexpr int addressable = 1 << 12;
+
+    explicit PhysicalMemory(const string& filename = "pt_initialize.txt")
+        : image(filename) {
+        if (!image.is_open()) {
             cout << "Unable to open page table init file";
-        dmem.close();
+        } else if (is_binary_file(filename)) {
+            bytes = image.data();
+            size = image.size();
+            return;
+        }
+        text.assign(addressable + 3, 0);
+        const char* p = reinterpret_cast< const char* >(image.data());
+        const char* end = p + image.size();
+        for (std::size_t i = 0; p < end && i < text.size(); i++) {
+            unsigned byte = 0;
+            for (; p < end && (*p == '0' || *p == '1'); p++) {
+                byte = byte << 1 | (*p - '0');
+            }
+            text[i] = byte;
+            while (p < end && *p++ != '\n') {
+            }
+        }
+        bytes = text.data();
+        size = text.size();
     }
 
     unsigned operator[](int index) {
-        if (index >= (1 << 12)) {
+        if (index >= addressable) {
             throw std::out_of_range("Memory access out of range");
         }
-        return DMem[index + 0].to_ulong() << 24 |
-               DMem[index + 1].to_ulong() << 16 |
-               DMem[index + 2].to_ulong() << 8 |
-               DMem[index + 3].to_ulong() << 0;
+        const std::size_t at = index;
+        if (at + 4 <= size) {
+            return unsigned(bytes[at]) << 24 | unsigned(bytes[at + 1]) << 16 |
+                   unsigned(bytes[at + 2]) << 8 | unsigned(bytes[at + 3]);
+        }
+        unsigned word = 0;
+        for (std::size_t i = at; i < at + 4; i++) {
+            word = word << 8 | (i < size ? bytes[i] : 0);
+        }
+        return word;
+    }
+
+    void write(int index, unsigned value) {
+        const std::size_t at = index;
+        if (index >= addressable || at + 4 > size) {
+            throw std::out_of_range("Memory access out of range");
+        }
+        bytes[at + 0] = value >> 24;
+        bytes[at + 1] = value >> 16;
+        bytes[at + 2] = value >> 8;
+        bytes[at + 3] = value >> 0;
+    }
+
+    // the addressable bytes as a binary image, for --memory=<file>.bin
+    void save(const string& filename) const {
+        ofstream out(filename, ios::binary);
+        for (std::size_t i = 0; i < addressable; i++) {
+            out.put(i < size ? bytes[i] : 0);
+        }
+        if (!out) {
+            throw std::runtime_error("cannot write " + filename);
+        }
     }
 
     bitset< 32 > outputMemValue(bitset< 12 > address_bits) {
@@ -108,9 +227,69 @@ class PhysicalMemory {
     }
 
    private:
-    vector< bitset< 8 > > DMem;
+    MappedFile image;
+    std::vector< std::uint8_t > text;  // bytes of a text image
+    std::uint8_t* bytes = nullptr;
+    std::size_t size = 0;
+};
+
+struct Requests {
+    std::vector< std::uint64_t > va;
+    std::vector< bool > is_write;
 };
 
+std::optional< Requests > load_requests(const string& filename, int va_bits) {
+    /*
+     * - "*.bin"   2-byte big-endian words, the address in the low bits and
+     *             bit 15 set for a store
+     * - else      a line per request, the address in binary, or in hex
+     *             after "0x" (requests_hex.txt), optionally followed by
+     *             " W" for a store
+     */
+    const MappedFile file(filename);
+    if (!file.is_open()) {
+        return std::nullopt;
+    }
+    Requests requests;
+    const std::uint8_t* p = file.data();
+    if (is_binary_file(filename)) {
+        const std::size_t n = file.size() / 2;
+        requests.va.resize(n);
+        requests.is_write.resize(n);
+        for (std::size_t i = 0; i < n; i++) {
+            const unsigned word = p[2 * i] << 8 | p[2 * i + 1];
+            requests.va[i] = word & bitmask(va_bits);
+            requests.is_write[i] = word >> 15;
+        }
+        return requests;
+    }
+
+    const std::uint8_t* end = p + file.size();
+    while (p < end) {
+        std::uint64_t va = 0;
+        if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+            for (p += 2; p < end && std::isxdigit(*p); p++) {
+                const int digit = std::isdigit(*p)
+                                      ? *p - '0'
+                                      : std::tolower(*p) - 'a' + 10;
+                va = va << 4 | digit;
+            }
+        } else {
+            for (; p < end && (*p == '0' || *p == '1'); p++) {
+                va = va << 1 | (*p - '0');
+            }
+        }
+        bool is_write = false;
+        for (; p < end && *p != '\n'; p++) {
+            is_write |= *p == 'W';
+        }
+        p++;
+        requests.va.push_back(va & bitmask(va_bits));
+        requests.is_write.push_back(is_write);
+    }
+    return requests;
+}
+
 class VirtualAddress {
    public:
     static constexpr int n_bits_outer = 4;
@@ -184,57 +363,384 @@ class PhysicalAddress {
     unsigned frame_offset;
 };
 
-class OuterPageTable {
-   public:
-    OuterPageTable(PhysicalMemory& memory_, unsigned pt_addr_)
-        : memory(memory_), pt_addr(pt_addr_) {}
-
-    OuterPageTableEntry operator[](int index) {
-        const unsigned addr_offset = index << 2;
-        if (addr_offset >= page_size) {
-            throw std::out_of_range("Outer-PT access out of range");
+// the lab's 4/4/6 bit layout, from the field widths above; the lowest unused
+// bit of an outer PTE is its page-size bit, a 1 KiB page at inner_table_addr
+constexpr const int outer_page_size_bit = OuterPageTableEntry::n_bits_valid;
+
+using LabLayout = layout::Layout<
+    OuterPageTableEntry::n_bits_pa, 4,
+    layout::PteFormat< OuterPageTableEntry::n_bits_unused +
+                           OuterPageTableEntry::n_bits_valid,
+                       OuterPageTableEntry::n_bits_pa, 0, 0,
+                       outer_page_size_bit >,
+    layout::PteFormat< InnerPageTableEntry::n_bits_unused +
+                           InnerPageTableEntry::n_bits_valid,
+                       InnerPageTableEntry::n_bits_frame,
+                       VirtualAddress::n_bits_offset >,
+    VirtualAddress::n_bits_offset, VirtualAddress::n_bits_outer,
+    VirtualAddress::n_bits_inner >;
+
+struct Options {
+    /*
+     * optional flags after <requests> <PTBR>
+     *   --tlb=<N>              N-entry TLB in front of the walk (tlb.h)
+     *   --tlb-ways=<N>         its associativity
+     *   --tlb-policy=<name>    its replacement policy, as in the cache
+     *                          simulator (lru, fifo, plru, ...)
+     *   --l2-tlb=<N>           N-entry second-level TLB
+     *   --l2-tlb-ways=<N>      its associativity
+     *   --huge-tlb=<N>         N TLB entries for huge pages
+     *   --huge-tlb-ways=<N>    their associativity
+     *   --pwc=<N>              N-entry page-walk cache of the levels above
+     *                          the last, same replacement policy as the TLB
+     *   --pwc-ways=<N>         its associativity (default: fully
+     *                          associative)
+     *   --layout=<name>        lab (default): <requests> are 14-bit
+     *                          addresses (see load_requests) translated
+     *                          through the tables in the memory image from
+     *                          <PTBR>
+     *                          x86-32, x86-64: <requests> are hex addresses,
+     *                          every requested page is mapped in generated
+     *                          tables (layout.h) and <PTBR> is ignored
+     *   --huge-pages[=<N>]     x86 layouts: a huge-page region with at
+     *                          least N requested pages (default 1) is
+     *                          mapped by one huge page
+     *   --memory=<file>        the lab's memory image (default:
+     *                          pt_initialize.txt); "*.bin" images are raw
+     *                          bytes, mapped into memory
+     *   --save-memory=<file>   write the memory image as raw bytes first
+     *   --inverted             also translate the requests with a hashed
+     *                          inverted page table built from the same
+     *                          mappings (inverted.h), and compare its size
+     *                          and probes per lookup with the radix walk
+     *   --batch                translate the lab's requests in blocks
+     *                          (layout::BatchWalker) with bulk output, no
+     *                          TLB or page-walk cache
+     *   --threads[=<N>]        batched translation on N threads (default:
+     *                          all cores), output still in trace order
+     *   --demand-paging=<name> invalid PTEs are page faults handled with
+     *                          clock, second-chance, lru or working-set
+     *                          replacement (paging.h); a request line may
+     *                          end in " W" for a store
+     *   --frames=<N>           frames available to pages
+     *   --ws-window=<N>        working-set window, in references
+     */
+    tlb::Params tlb;
+    int pwc_entries = 0;
+    int pwc_ways = 0;
+    string layout = "lab";
+    std::uint64_t huge_pages = 0;  // threshold, 0: base pages only
+    string memory = "pt_initialize.txt";
+    string save_memory;
+    bool inverted = false;
+    bool batch = false;
+    unsigned threads = 1;
+    std::optional< paging::Params > paging;
+
+    Options(int argc, char* argv[]) {
+        if (argc < 3) {
+            throw std::invalid_argument("missing <requests> or <PTBR>");
         }
-        if (addr_offset % 4 != 0) {
-            throw std::invalid_argument("Unaligned outer-PT memory access");
+        for (int i = 3; i < argc; i++) {
+            const string arg = argv[i];
+            const auto eq = arg.find('=');
+            const string key = arg.substr(0, eq);
+            const string value = eq == string::npos ? "" : arg.substr(eq + 1);
+
+            if (key == "--tlb") {
+                tlb.entries = std::stoi(value);
+            } else if (key == "--tlb-ways") {
+                tlb.ways = std::stoi(value);
+            } else if (key == "--tlb-policy") {
+                tlb.policy = value;
+            } else if (key == "--l2-tlb") {
+                tlb.l2_entries = std::stoi(value);
+            } else if (key == "--l2-tlb-ways") {
+                tlb.l2_ways = std::stoi(value);
+            } else if (key == "--huge-tlb") {
+                tlb.huge_entries = std::stoi(value);
+            } else if (key == "--huge-tlb-ways") {
+                tlb.huge_ways = std::stoi(value);
+            } else if (key == "--pwc") {
+                pwc_entries = std::stoi(value);
+            } else if (key == "--pwc-ways") {
+                pwc_ways = std::stoi(value);
+            } else if (key == "--layout") {
+                layout = value;
+            } else if (key == "--huge-pages") {
+                huge_pages = value.empty() ? 1 : std::stoull(value);
+            } else if (key == "--memory") {
+                memory = value;
+            } else if (key == "--save-memory") {
+                save_memory = value;
+            } else if (key == "--inverted") {
+                inverted = true;
+            } else if (key == "--batch") {
+                batch = true;
+            } else if (key == "--demand-paging") {
+                demand_paging().replacement = paging::parse_policy(value);
+            } else if (key == "--frames") {
+                demand_paging().frames = std::stoi(value);
+            } else if (key == "--ws-window") {
+                demand_paging().window = std::stoull(value);
+            } else if (key == "--threads") {
+                batch = true;
+                threads = value.empty() ? std::thread::hardware_concurrency()
+                                        : std::stoul(value);
+                threads = std::max(threads, 1U);
+            } else {
+                throw std::invalid_argument("unknown option: " + arg);
+            }
         }
-        return memory[pt_addr + addr_offset];
     }
 
-    PhysicalMemory& memory;
-    unsigned pt_addr;
+   private:
+    paging::Params& demand_paging() {
+        if (!paging) {
+            paging.emplace();
+        }
+        return *paging;
+    }
 };
 
-class InnerPageTable {
+template < typename Policy, typename Layout, typename Memory >
+class Translator {
+    /*
+     * the page walk of Layout over Memory, counting the page-table reads,
+     * behind two optional caches:
+     * - a TLB of page addresses by virtual page number, and of huge pages
+     * - a page-walk cache of last-level table addresses by the indices of
+     *   the levels above, so a walk that hits it reads only the last PTE
+     */
    public:
-    InnerPageTable(PhysicalMemory& memory_, unsigned pt_addr_)
-        : memory(memory_), pt_addr(pt_addr_) {}
+    Translator(Memory& memory, std::uint64_t root, const Options& opts)
+        : walker(memory, root) {
+        if (opts.tlb.entries > 0) {
+            tlb.emplace(opts.tlb, Layout::offset_bits, Layout::huge_bits);
+        }
+        if (opts.pwc_entries > 0 && Layout::levels > 1) {
+            walk_cache.emplace(opts.pwc_entries, opts.pwc_ways
+                                                     ? opts.pwc_ways
+                                                     : opts.pwc_entries);
+        }
+    }
+
+    layout::Walk translate(std::uint64_t va) {
+        layout::Walk w;
+        if (tlb && tlb->lookup(va, w.address)) {
+            w.valid_levels = Layout::levels;
+            return w;
+        }
+        w = walk(va);
+        if (tlb && w.valid_levels == Layout::levels) {
+            tlb->insert(va, w.address, w.page_bits);
+        }
+        return w;
+    }
+
+    // the page's mapping changed
+    void invalidate(std::uint64_t vpn) {
+        if (tlb) {
+            tlb->invalidate(vpn);
+        }
+    }
+
+    void report(std::ostream& out) const {
+        if (tlb) {
+            tlb->report(out);
+        }
+        out << "page walks: " << walks << ", page-table reads: "
+            << memory_reads << endl;
+        if (walk_cache) {
+            out << "page-walk cache: " << pwc_hits << " hits of " << walks
+                << " walks, " << pwc_hits * (Layout::levels - 1)
+                << " page-table reads saved" << endl;
+        }
+        if (huge_walks > 0) {
+            out << "huge pages: " << huge_walks << " walks ended early, "
+                << huge_reads_saved << " page-table reads saved" << endl;
+        }
+    }
+
+    std::uint64_t walks = 0;
+    std::uint64_t memory_reads = 0;  // page-table entries read
+    std::uint64_t pwc_hits = 0;
+    std::uint64_t huge_walks = 0;  // found a huge page
+    std::uint64_t huge_reads_saved = 0;
 
-    InnerPageTableEntry operator[](int index) {
-        const unsigned addr_offset = index << 2;
-        if (addr_offset >= page_size) {
-            throw std::out_of_range("Inner-PT access out of range");
+   private:
+    layout::Walk walk(std::uint64_t va) {
+        walks++;
+        // the virtual address bits above the last level's index
+        const std::uint64_t upper =
+            va >> (Layout::offset_bits +
+                   Layout::level_bits[Layout::levels - 1]);
+        std::uint64_t table;
+        layout::Walk w;
+        if (walk_cache && walk_cache->lookup(upper, table)) {
+            pwc_hits++;
+            w = walker.walk_leaf(va, table);
+        } else {
+            w = walker.walk(va);
+            // only a walk that reached the last level read a last-level
+            // table
+            const bool reached_leaf =
+                w.valid_levels == Layout::levels - 1 ||
+                w.page_bits == Layout::offset_bits;
+            if (walk_cache && reached_leaf) {
+                walk_cache->insert(upper, w.table);
+            }
         }
-        if (addr_offset % 4 != 0) {
-            throw std::invalid_argument("Unaligned inner-PT memory access");
+        if (w.page_bits > Layout::offset_bits) {
+            huge_walks++;
+            huge_reads_saved +=
+                Layout::levels - 1 - Layout::level_of(w.page_bits);
         }
-        return memory[pt_addr + addr_offset];
+        memory_reads += w.reads;
+        return w;
     }
 
-    PhysicalMemory& memory;
-    unsigned pt_addr;
+    layout::Walker< Layout, Memory > walker;
+    std::optional< tlb::Tlb< Policy > > tlb;
+    std::optional< tlb::Level< Policy > > walk_cache;
 };
 
-int main([[maybe_unused]] int argc, char* argv[]) {
-    PhysicalMemory phy_mem;
+template < typename Layout, typename Memory >
+void compare_inverted(Memory& memory, std::uint64_t root,
+                      std::uint64_t frames,
+                      const std::vector< std::uint64_t >& requests,
+                      const std::vector< std::uint64_t >& radix_pages,
+                      double radix_reads_per_walk) {
+    /*
+     * the radix tables at `root` against a hashed inverted page table of
+     * `frames` frames holding the same mappings: radix_pages[i] is the page
+     * address the radix walk found for requests[i], none if it failed
+     */
+    using Table = inverted::HashedTable< Layout >;
+    Table table(frames);
+    std::uint64_t aliased = 0;
+    const std::uint64_t radix_bytes = inverted::for_each_page< Layout >(
+        memory, root, [&](std::uint64_t vpn, std::uint64_t page) {
+            aliased += !table.insert(vpn, page / Layout::page_size);
+        });
+
+    std::uint64_t disagree = 0;
+    for (std::size_t i = 0; i < requests.size(); i++) {
+        std::uint64_t frame;
+        const std::uint64_t page =
+            table.lookup(requests[i] >> Layout::offset_bits, frame)
+                ? frame * Layout::page_size
+                : Table::none;
+        disagree += page != radix_pages[i];
+    }
+
+    const auto ratio = [](double a, double b) { return b > 0 ? a / b : 0; };
+    cout << "radix page table: " << radix_bytes << " bytes, "
+         << radix_reads_per_walk << " reads per walk" << endl;
+    cout << "hashed inverted page table: " << table.table_bytes()
+         << " bytes for " << table.frames() << " frames, "
+         << ratio(table.stats.probes, table.stats.lookups)
+         << " probes per lookup (plus the anchor), longest chain "
+         << table.longest_chain << endl;
+    if (aliased > 0 || disagree > 0) {
+        cout << "  " << aliased << " pages share a frame with another, "
+             << disagree << " requests translated differently" << endl;
+    }
+}
+
+void translate_chunk(PhysicalMemory& phy_mem, unsigned ptbr,
+                     const std::uint64_t* requests, std::size_t n,
+                     std::string& out) {
+    // requests[0, n) walked in blocks, their result lines appended to out
+    using Walker = layout::BatchWalker< LabLayout, PhysicalMemory >;
+    Walker walker(phy_mem, ptbr);
+    std::array< int, Walker::block > valid;
+    std::array< std::uint64_t, Walker::block > page;
+    for (std::size_t from = 0; from < n; from += Walker::block) {
+        const std::size_t count = std::min(Walker::block, n - from);
+        walker.walk(requests + from, count, valid.data(), page.data());
+        for (std::size_t i = 0; i < count; i++) {
+            char buffer[32];
+            if (valid[i] == LabLayout::levels) {
+                const unsigned phy_addr =
+                    page[i] |
+                    (requests[from + i] & bitmask(LabLayout::offset_bits));
+                std::snprintf(buffer, sizeof(buffer), "1, 1, 0x%03x, 0x%08x\n",
+                              phy_addr, phy_mem[phy_addr]);
+                out += buffer;
+            } else {
+                out += valid[i] ? "1, 0, 0x000, 0x00000000\n"
+                                : "0, 0, 0x000, 0x00000000\n";
+            }
+        }
+    }
+}
+
+int run_lab_batch(const Options& opts, char* argv[]) {
+    /*
+     * same results as run_lab: the requests are read up front and walked
+     * in blocks, and every chunk's lines are formatted into one buffer.
+     * The page tables are only read, so with several threads each takes a
+     * chunk of a round against the shared PhysicalMemory, and the round's
+     * buffers are written in trace order before the next round starts.
+     */
+    PhysicalMemory phy_mem(opts.memory);
+    const auto loaded = load_requests(argv[1], LabLayout::va_bits);
+    ifstream PTB_file(argv[2]);
+    ofstream tracesout("pt_results.txt");
+    if (!loaded || !tracesout.is_open()) {
+        cout << "Unable to open trace or traceout file ";
+        return 0;
+    }
+    bitset< 12 > PTBR;
+    PTB_file >> PTBR;
+
+    const auto& requests = loaded->va;
+    const unsigned threads = opts.threads;
+
+    constexpr std::size_t chunk = 1 << 16;
+    std::vector< std::string > buffers(threads);
+    for (std::size_t round = 0; round < requests.size();
+         round += chunk * threads) {
+        std::vector< std::thread > workers;
+        unsigned used = 0;
+        for (; used < threads; used++) {
+            const std::size_t from = round + used * chunk;
+            if (from >= requests.size()) {
+                break;
+            }
+            const std::size_t n = std::min(chunk, requests.size() - from);
+            buffers[used].clear();
+            if (threads == 1) {
+                translate_chunk(phy_mem, PTBR.to_ulong(), &requests[from], n,
+                                buffers[used]);
+            } else {
+                workers.emplace_back(translate_chunk, std::ref(phy_mem),
+                                     PTBR.to_ulong(), &requests[from], n,
+                                     std::ref(buffers[used]));
+            }
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        for (unsigned t = 0; t < used; t++) {
+            tracesout << buffers[t];
+        }
+    }
+    return 0;
+}
+
+template < typename Policy >
+int run_lab(const Options& opts, char* argv[]) {
+    PhysicalMemory phy_mem(opts.memory);
 
-    ifstream traces;
     ifstream PTB_file;
     ofstream tracesout;
 
     string outname;
     outname = "pt_results.txt";
 
-    traces.open(argv[1]);
+    const auto requests = load_requests(argv[1], LabLayout::va_bits);
     PTB_file.open(argv[2]);
     tracesout.open(outname.c_str());
 
@@ -242,43 +748,203 @@ int main([[maybe_unused]] int argc, char* argv[]) {
     bitset< 12 > PTBR;
     PTB_file >> PTBR;
 
-    auto outer_page_table = OuterPageTable(phy_mem, PTBR.to_ulong());
+    auto translator = Translator< Policy, LabLayout, PhysicalMemory >(
+        phy_mem, PTBR.to_ulong(), opts);
+    std::optional< paging::Pager< LabLayout, PhysicalMemory > > pager;
+    if (opts.paging) {
+        pager.emplace(phy_mem, PTBR.to_ulong(), *opts.paging);
+    }
+    // the requests' pages, for the inverted page table
+    std::vector< std::uint64_t > pages;
 
     // Read a virtual address form the PageTable and convert it to the
     // physical address
-    if (traces.is_open() && tracesout.is_open()) {
-        string line;
-        while (getline(traces, line)) {
-            const auto virtual_addr_bits = bitset< 14 >(line);
-            const auto virtual_addr =
-                VirtualAddress(virtual_addr_bits.to_ulong());
-            const auto outer_pte =
-                outer_page_table[virtual_addr.outer_page_number];
-
-            if (outer_pte.valid) {
-                auto inner_page_table =
-                    InnerPageTable(phy_mem, outer_pte.inner_table_addr);
-                const auto inner_pte =
-                    inner_page_table[virtual_addr.inner_page_number];
-
-                if (inner_pte.valid) {
-                    auto phy_addr = PhysicalAddress(inner_pte.frame_num,
-                                                    virtual_addr.offset);
-                    tracesout << std::hex << std::setfill('0') << "1, 1, 0x"
-                              << std::setw(3) << phy_addr << ", 0x"
-                              << std::setw(8) << phy_mem[phy_addr] << endl;
-                    std::cout.copyfmt(oldCoutState);
-                } else {
-                    tracesout << "1, 0, 0x000, 0x00000000" << endl;
+    if (requests && tracesout.is_open()) {
+        for (std::size_t i = 0; i < requests->va.size(); i++) {
+            const auto virtual_addr = VirtualAddress(requests->va[i]);
+            auto translation = translator.translate(virtual_addr.value);
+
+            if (pager) {
+                if (translation.valid_levels < LabLayout::levels) {
+                    for (const auto vpn :
+                         pager->fault(virtual_addr.value, translation)) {
+                        translator.invalidate(vpn);
+                    }
+                    translation = translator.translate(virtual_addr.value);
                 }
+                pager->reference(translation.address,
+                                 requests->is_write[i]);
+            }
+
+            if (opts.inverted) {
+                pages.push_back(translation.valid_levels == LabLayout::levels
+                                    ? translation.address
+                                    : inverted::HashedTable<
+                                          LabLayout >::none);
+            }
+
+            // one valid flag per level in the output; a huge page found at
+            // the outer level counts as all levels valid (Walk), so it is
+            // printed as translated, with both flags set
+            static_assert(LabLayout::levels == 2, "two valid flags per line");
+            if (translation.valid_levels == LabLayout::levels) {
+                auto phy_addr = PhysicalAddress(
+                    translation.address >> VirtualAddress::n_bits_offset,
+                    virtual_addr.offset);
+                tracesout << std::hex << std::setfill('0') << "1, 1, 0x"
+                          << std::setw(3) << phy_addr << ", 0x" << std::setw(8)
+                          << phy_mem[phy_addr] << '\n';
+                std::cout.copyfmt(oldCoutState);
+            } else if (translation.valid_levels > 0) {
+                tracesout << "1, 0, 0x000, 0x00000000\n";
             } else {
-                tracesout << "0, 0, 0x000, 0x00000000" << endl;
+                tracesout << "0, 0, 0x000, 0x00000000\n";
             }
         }
-        traces.close();
         tracesout.close();
+
+        if (opts.tlb.entries > 0 || opts.pwc_entries > 0) {
+            translator.report(cout);
+        }
+        if (pager) {
+            pager->report(cout);
+        }
+        if (opts.inverted) {
+            compare_inverted< LabLayout >(
+                phy_mem, PTBR.to_ulong(),
+                1ULL << (LabLayout::pa_bits - LabLayout::offset_bits),
+                requests->va, pages,
+                double(translator.memory_reads) / translator.walks);
+        }
     }
 
     else
         cout << "Unable to open trace or traceout file ";
+    return 0;
+}
+
+template < typename Policy, typename Layout >
+int run_layout(const Options& opts, const string& tracename) {
+    /*
+     * walk costs of a realistic layout: the tables are generated to map
+     * every page the requests touch, then the requests are translated in
+     * order and the physical addresses written to pt_results.txt
+     */
+    ifstream traces(tracename);
+    ofstream tracesout("pt_results.txt");
+    if (!traces.is_open() || !tracesout.is_open()) {
+        cout << "Unable to open trace or traceout file ";
+        return 1;
+    }
+
+    std::vector< std::uint64_t > requests;
+    string line;
+    while (getline(traces, line)) {
+        if (!line.empty()) {
+            requests.push_back(std::stoull(line, nullptr, 16) &
+                               layout::mask(Layout::va_bits));
+        }
+    }
+    // requested pages per huge-page region, to pick the ones mapped huge
+    std::unordered_map< std::uint64_t, std::unordered_set< std::uint64_t > >
+        regions;
+    if (opts.huge_pages > 0) {
+        for (const auto va : requests) {
+            regions[va >> Layout::huge_bits].insert(va >>
+                                                    Layout::offset_bits);
+        }
+    }
+    layout::SparseTables< Layout > tables;
+    for (const auto va : requests) {
+        const auto region = regions.find(va >> Layout::huge_bits);
+        tables.map(va, region != regions.end() &&
+                           region->second.size() >= opts.huge_pages);
+    }
+
+    using Tables = layout::SparseTables< Layout >;
+    auto translator =
+        Translator< Policy, Layout, Tables >(tables, tables.root, opts);
+    std::vector< std::uint64_t > pages;
+    for (const auto va : requests) {
+        const auto translation = translator.translate(va);
+        if (opts.inverted) {
+            pages.push_back(translation.address);
+        }
+        tracesout << "0x" << std::hex
+                  << (translation.address |
+                      (va & layout::mask(Layout::offset_bits)))
+                  << std::dec << '\n';
+    }
+
+    translator.report(cout);
+    cout << "page tables: " << Layout::levels << " levels, tables per level";
+    for (const auto n : tables.tables) {
+        cout << ' ' << n;
+    }
+    cout << ", " << tables.table_bytes() << " bytes mapping " << tables.pages
+         << " pages";
+    if (tables.huge_pages > 0) {
+        cout << " and " << tables.huge_pages << " huge pages of "
+             << (1ULL << Layout::huge_bits) << " bytes";
+    }
+    cout << endl;
+    if (translator.walks > 0) {
+        cout << "page-table reads per walk: "
+             << double(translator.memory_reads) / translator.walks << endl;
+    }
+    if (opts.inverted) {
+        // physical memory is what the generated tables allocated
+        compare_inverted< Layout >(
+            tables, tables.root, tables.physical_pages(), requests, pages,
+            double(translator.memory_reads) / translator.walks);
+    }
+    return 0;
+}
+
+int run(int argc, char* argv[]) {
+    const Options opts(argc, argv);
+    if (!opts.save_memory.empty()) {
+        PhysicalMemory(opts.memory).save(opts.save_memory);
+    }
+    // the TLB's replacement policy and the layout are template parameters,
+    // picked once
+    return replacement::with_policy(opts.tlb.policy, [&](auto policy) {
+        using Policy = typename decltype(policy)::type;
+        if (opts.layout == "lab" && opts.batch) {
+            if (opts.tlb.entries > 0 || opts.pwc_entries > 0 || opts.paging ||
+                opts.inverted) {
+                throw std::invalid_argument(
+                    "batched translation has no TLB, page-walk cache, "
+                    "demand paging or inverted page table");
+            }
+            return run_lab_batch(opts, argv);
+        }
+        if (opts.paging && opts.inverted) {
+            throw std::invalid_argument(
+                "the inverted page table is built before demand paging "
+                "changes the tables");
+        }
+        if (opts.layout == "lab") {
+            return run_lab< Policy >(opts, argv);
+        }
+        if (opts.layout == "x86-32") {
+            return run_layout< Policy, layout::x86_32 >(opts, argv[1]);
+        }
+        if (opts.layout == "x86-64") {
+            return run_layout< Policy, layout::x86_64 >(opts, argv[1]);
+        }
+        throw std::invalid_argument("unknown layout: " + opts.layout);
+    });
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        return run(argc, argv);
+    } catch (const std::invalid_argument& e) {
+        // a bad option or combination of options, not a translation failure
+        cout << "error: " << e.what() << endl
+             << "usage: " << argv[0] << " <requests> <PTBR> [options]"
+             << endl;
+        return 1;
+    }
 }
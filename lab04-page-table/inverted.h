@@ -0,0 +1,145 @@
+/* Hashed inverted page table
+
+The alternative to a radix tree of per-address-space tables: one entry per
+physical frame, so its size follows physical memory instead of how sparse
+the virtual address space is. A lookup hashes the virtual page number into
+the hash anchor table, whose slot holds the first frame of a chain; the
+chain is followed through the frames' entries until one holds the VPN.
+
+Sizes, in words of the layout's PTE size:
+- the anchor table has a slot per frame, rounded up to a power of two, one
+  word each (a frame number)
+- every frame entry has two words, the VPN tag and the next frame in its
+  chain
+
+A frame holds one page, so a frame mapped by several virtual pages keeps its
+first owner and the others cannot be translated. Huge pages are splintered
+into their frames.
+
+for_each_page() enumerates the mappings of radix tables to build the table
+from, and measures the radix tables on the way.
+*/
+
+#ifndef INVERTED_H_
+#define INVERTED_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace inverted {
+
+// calls f(vpn, page address) for every base page mapped by the tables at
+// `table`, of `level` and below; returns the bytes of those tables
+template < typename Layout, typename Memory, typename F >
+std::uint64_t for_each_page(Memory& memory, std::uint64_t table, F&& f,
+                            int level = 0, std::uint64_t prefix = 0) {
+    std::uint64_t bytes = Layout::table_bytes(level);
+    const bool leaf = level == Layout::levels - 1;
+    for (std::uint64_t i = 0; i < (1ULL << Layout::level_bits[level]); i++) {
+        const std::uint64_t pte = memory[table + i * Layout::pte_bytes];
+        const std::uint64_t index = prefix << Layout::level_bits[level] | i;
+        if (leaf) {
+            if (Layout::leaf_format::valid(pte)) {
+                f(index, Layout::leaf_format::address(pte));
+            }
+        } else if (!Layout::table_format::valid(pte)) {
+            continue;
+        } else if (Layout::table_format::huge(pte)) {
+            const int bits = Layout::shift(level) - Layout::offset_bits;
+            const std::uint64_t base = Layout::table_format::address(pte) &
+                                       ~((1ULL << Layout::shift(level)) - 1);
+            for (std::uint64_t k = 0; k < (1ULL << bits); k++) {
+                f(index << bits | k, base + k * Layout::page_size);
+            }
+        } else {
+            bytes += for_each_page< Layout >(
+                memory, Layout::table_format::address(pte), f, level + 1,
+                index);
+        }
+    }
+    return bytes;
+}
+
+struct Stats {
+    std::uint64_t lookups = 0;
+    std::uint64_t hits = 0;
+    std::uint64_t probes = 0;  // frame entries compared
+};
+
+template < typename Layout >
+class HashedTable {
+   public:
+    static constexpr std::uint64_t none = ~0ULL;
+    static constexpr std::uint64_t anchor_bytes = Layout::pte_bytes;
+    static constexpr std::uint64_t entry_bytes = 2 * Layout::pte_bytes;
+
+    explicit HashedTable(std::uint64_t frames) : entries(frames) {
+        std::uint64_t slots = 1;
+        while (slots < frames) {
+            slots <<= 1;
+            slot_bits++;
+        }
+        anchors.assign(slots, none);
+    }
+
+    // false if the frame already holds another page
+    bool insert(std::uint64_t vpn, std::uint64_t frame) {
+        auto& entry = entries.at(frame);
+        if (entry.valid) {
+            return false;
+        }
+        auto& anchor = anchors[slot(vpn)];
+        entry = {true, vpn, anchor};
+        anchor = frame;
+        auto length = 0U;
+        for (auto f = anchor; f != none; f = entries[f].next) {
+            length++;
+        }
+        longest_chain = std::max(longest_chain, length);
+        return true;
+    }
+
+    bool lookup(std::uint64_t vpn, std::uint64_t& frame) {
+        stats.lookups++;
+        for (auto f = anchors[slot(vpn)]; f != none; f = entries[f].next) {
+            stats.probes++;
+            if (entries[f].vpn == vpn) {
+                stats.hits++;
+                frame = f;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::uint64_t table_bytes() const {
+        return anchors.size() * anchor_bytes + entries.size() * entry_bytes;
+    }
+
+    std::uint64_t frames() const { return entries.size(); }
+
+    Stats stats;
+    unsigned longest_chain = 0;
+
+   private:
+    struct Entry {
+        bool valid = false;
+        std::uint64_t vpn = 0;
+        std::uint64_t next = none;  // frame
+    };
+
+    std::uint64_t slot(std::uint64_t vpn) const {
+        // Fibonacci hashing, the top bits pick the slot
+        return slot_bits ? (vpn * 0x9e3779b97f4a7c15ULL) >> (64 - slot_bits)
+                         : 0;
+    }
+
+    std::vector< Entry > entries;  // by frame
+    std::vector< std::uint64_t > anchors;
+    int slot_bits = 0;
+};
+
+}  // namespace inverted
+
+#endif
@@ -0,0 +1,394 @@
+/* Compile-time page-table layouts
+
+A layout describes a radix page table completely at compile time:
+- the number of levels and the virtual address bits indexing each level,
+  from the root down, above the page offset bits
+- the size of a PTE in bytes and the physical address width
+- the PTE formats of intermediate levels (pointing to the next table) and of
+  the last level (pointing to the page), see PteFormat
+
+Walker< Layout, Memory > is instantiated per layout, so the shifts, masks
+and the number of steps of a walk are constants and every level gets its
+own step of the loop. BatchWalker does the same for a block of addresses at
+once, level by level. Memory is anything with operator[](address) returning
+the PTE stored there, e.g. the lab's PhysicalMemory image, or SparseTables,
+which builds the tables of a synthetic address space on demand.
+
+Layouts provided here, next to the lab's 4/4/6 bit one in PageTable.cpp:
+- x86_32   2 levels of 10 bits, 4 KiB pages, 32-bit virtual and physical
+           addresses, 4-byte PTEs
+- x86_64   4 levels of 9 bits, 4 KiB pages, 48-bit virtual and 52-bit
+           physical addresses, 8-byte PTEs
+Both use a present bit 0 and the page frame number in bits 12 and up.
+
+Huge pages: a PTE format may have a page-size bit. An intermediate PTE with
+it set maps a page directly and the walk ends there, the page covering all
+the virtual address bits below that level's index (4 MiB on x86_32, 2 MiB
+and 1 GiB on x86_64, bit 7 in both). Walks report the page's offset bits,
+and its address at base-page granularity, so callers still add the base
+page offset only.
+*/
+
+#ifndef LAYOUT_H_
+#define LAYOUT_H_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+
+namespace layout {
+
+constexpr std::uint64_t mask(int bits) {
+    return bits >= 64 ? ~0ULL : (1ULL << bits) - 1;
+}
+
+template < int AddrShift, int AddrBits, int AddrScale, int ValidBit = 0,
+           int HugeBit = -1 >
+struct PteFormat {
+    // bits [AddrShift, AddrShift + AddrBits) hold the physical address of the
+    // next table or page, shifted right by AddrScale; HugeBit < 0: no huge
+    // pages
+    static constexpr bool valid(std::uint64_t pte) {
+        return (pte >> ValidBit) & 1;
+    }
+
+    static constexpr bool huge(std::uint64_t pte) {
+        if constexpr (HugeBit < 0) {
+            return false;
+        } else {
+            return (pte >> HugeBit) & 1;
+        }
+    }
+
+    static constexpr std::uint64_t address(std::uint64_t pte) {
+        return ((pte >> AddrShift) & mask(AddrBits)) << AddrScale;
+    }
+
+    static constexpr std::uint64_t make(std::uint64_t address) {
+        return (address >> AddrScale) << AddrShift | 1ULL << ValidBit;
+    }
+
+    static constexpr std::uint64_t make_huge(std::uint64_t address) {
+        static_assert(HugeBit >= 0, "this PTE format has no huge pages");
+        return make(address) | 1ULL << HugeBit;
+    }
+};
+
+template < int PaBits, int PteBytes, typename TableFormat, typename LeafFormat,
+           int OffsetBits, int... LevelBits >
+struct Layout {
+    using table_format = TableFormat;
+    using leaf_format = LeafFormat;
+
+    static constexpr int levels = sizeof...(LevelBits);
+    static constexpr std::array< int, levels > level_bits = {LevelBits...};
+    static constexpr int offset_bits = OffsetBits;
+    static constexpr int va_bits = (OffsetBits + ... + LevelBits);
+    static constexpr int pa_bits = PaBits;
+    static constexpr int pte_bytes = PteBytes;
+    static constexpr std::uint64_t page_size = 1ULL << OffsetBits;
+    // pages mapped by the level above the last
+    static constexpr int huge_bits =
+        sizeof...(LevelBits) > 1
+            ? OffsetBits + std::array< int, levels >{LevelBits...}[levels - 1]
+            : OffsetBits;
+
+    static_assert(levels >= 1, "a page table needs at least one level");
+    static_assert(va_bits <= 64 && pa_bits <= 64);
+
+    // lowest virtual address bit of `level`'s index
+    static constexpr int shift(int level) {
+        int bits = offset_bits;
+        for (int i = level + 1; i < levels; i++) {
+            bits += level_bits[i];
+        }
+        return bits;
+    }
+
+    static constexpr std::uint64_t index(std::uint64_t va, int level) {
+        return (va >> shift(level)) & mask(level_bits[level]);
+    }
+
+    // the level whose PTEs map pages with `page_bits` offset bits
+    static constexpr int level_of(int page_bits) {
+        int level = levels - 1;
+        while (level > 0 && shift(level) < page_bits) {
+            level--;
+        }
+        return level;
+    }
+
+    static constexpr std::uint64_t table_bytes(int level) {
+        return (1ULL << level_bits[level]) * pte_bytes;
+    }
+
+    static constexpr bool tables_fit_pages() {
+        for (int level = 0; level < levels; level++) {
+            if (table_bytes(level) > page_size) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+using x86_32 = Layout< 32, 4, PteFormat< 12, 20, 12, 0, 7 >,
+                       PteFormat< 12, 20, 12 >, 12, 10, 10 >;
+using x86_64 = Layout< 52, 8, PteFormat< 12, 40, 12, 0, 7 >,
+                       PteFormat< 12, 40, 12 >, 12, 9, 9, 9, 9 >;
+
+struct Walk {
+    int valid_levels = 0;       // valid PTEs on the path, from the root, all
+                                // levels once a huge page was found
+    std::uint64_t address = 0;  // of the base page, if all levels are valid
+    std::uint64_t table = 0;    // the last table the walk read from
+    int page_bits = 0;          // offset bits of the page found
+    int reads = 0;              // PTEs read from memory
+};
+
+// a huge page's base, plus the bits of `va` selecting the base page in it
+constexpr std::uint64_t huge_page_address(std::uint64_t base,
+                                          std::uint64_t va, int page_bits,
+                                          int offset_bits) {
+    return (base & ~mask(page_bits)) |
+           (va & mask(page_bits) & ~mask(offset_bits));
+}
+
+template < typename Layout, typename Memory >
+class Walker {
+   public:
+    Walker(Memory& memory_, std::uint64_t root_)
+        : memory(memory_), root(root_) {}
+
+    Walk walk(std::uint64_t va) const {
+        Walk w;
+        step< 0 >(va, root, w);
+        return w;
+    }
+
+    // only the last level, its table at `table`, for a walk cache holding
+    // the levels above
+    Walk walk_leaf(std::uint64_t va, std::uint64_t table) const {
+        Walk w;
+        w.valid_levels = Layout::levels - 1;
+        step< Layout::levels - 1 >(va, table, w);
+        return w;
+    }
+
+   private:
+    template < int Level >
+    void step(std::uint64_t va, std::uint64_t table, Walk& w) const {
+        constexpr bool leaf = Level == Layout::levels - 1;
+        using Format = std::conditional_t< leaf, typename Layout::leaf_format,
+                                           typename Layout::table_format >;
+        const std::uint64_t pte =
+            memory[table + Layout::index(va, Level) * Layout::pte_bytes];
+        w.table = table;
+        w.reads++;
+        if (!Format::valid(pte)) {
+            return;
+        }
+        w.valid_levels++;
+        if constexpr (leaf) {
+            w.address = Format::address(pte);
+            w.page_bits = Layout::offset_bits;
+        } else if (Format::huge(pte)) {
+            w.valid_levels = Layout::levels;
+            w.page_bits = Layout::shift(Level);
+            w.address = huge_page_address(Format::address(pte), va,
+                                          w.page_bits, Layout::offset_bits);
+        } else {
+            step< Level + 1 >(va, Format::address(pte), w);
+        }
+    }
+
+    Memory& memory;
+    std::uint64_t root;
+};
+
+template < typename Layout, typename Memory >
+class BatchWalker {
+    /*
+     * walks a block of addresses level by level instead of one address at
+     * a time: the PTE addresses of the whole block are computed first, then
+     * the PTEs of one level are read, one by one through Memory, for every
+     * address still on a valid path
+     *
+     * This is a scalar walker; what it saves is the per-request overhead
+     * around the walk, not PTE reads (the loops are not vectorized: the
+     * build has no -O flag and Memory's operator[] checks bounds)
+     */
+   public:
+    static constexpr std::size_t block = 64;
+
+    BatchWalker(Memory& memory_, std::uint64_t root_)
+        : memory(memory_), root(root_) {}
+
+    // va[0, n) -> valid_levels[0, n), address[0, n)
+    void walk(const std::uint64_t* va, std::size_t n, int* valid_levels,
+              std::uint64_t* address) {
+        for (std::size_t from = 0; from < n; from += block) {
+            const std::size_t count = std::min(block, n - from);
+            walk_block(va + from, count, valid_levels + from, address + from);
+        }
+    }
+
+    std::uint64_t reads = 0;  // PTEs read from memory
+
+   private:
+    void walk_block(const std::uint64_t* va, std::size_t n, int* valid,
+                    std::uint64_t* table) {
+        for (std::size_t i = 0; i < n; i++) {
+            valid[i] = 0;
+            table[i] = root;
+        }
+        level< 0 >(va, n, valid, table);
+        for (std::size_t i = 0; i < n; i++) {
+            if (valid[i] != Layout::levels) {
+                table[i] = 0;
+            }
+        }
+    }
+
+    template < int Level >
+    void level(const std::uint64_t* va, std::size_t n, int* valid,
+               std::uint64_t* table) {
+        constexpr bool leaf = Level == Layout::levels - 1;
+        using Format = std::conditional_t< leaf, typename Layout::leaf_format,
+                                           typename Layout::table_format >;
+        constexpr int shift = Layout::shift(Level);
+        constexpr std::uint64_t index_mask = mask(Layout::level_bits[Level]);
+
+        std::array< std::uint64_t, block > pte_addr;
+        for (std::size_t i = 0; i < n; i++) {
+            pte_addr[i] =
+                table[i] + ((va[i] >> shift) & index_mask) * Layout::pte_bytes;
+        }
+        for (std::size_t i = 0; i < n; i++) {
+            if (valid[i] == Level) {
+                const std::uint64_t pte = memory[pte_addr[i]];
+                reads++;
+                if (!Format::valid(pte)) {
+                    continue;
+                }
+                if (!leaf && Format::huge(pte)) {
+                    table[i] = huge_page_address(Format::address(pte), va[i],
+                                                 shift, Layout::offset_bits);
+                    valid[i] = Layout::levels;
+                } else {
+                    table[i] = Format::address(pte);
+                    valid[i]++;
+                }
+            }
+        }
+        if constexpr (!leaf) {
+            level< Level + 1 >(va, n, valid, table);
+        }
+    }
+
+    Memory& memory;
+    std::uint64_t root;
+};
+
+template < typename Layout >
+class SparseTables {
+    /*
+     * page tables of a synthetic address space: map() allocates the missing
+     * tables on a page's path and a frame for the page, each from the next
+     * free physical page, and only PTEs ever written are stored; a huge
+     * page is mapped by the level above the last, from aligned consecutive
+     * physical pages, unless base pages of its range are mapped already
+     */
+   public:
+    static_assert(Layout::tables_fit_pages(),
+                  "tables are allocated one physical page each");
+
+    SparseTables() { root = allocate_table(0); }
+
+    void map(std::uint64_t va, bool huge = false) {
+        std::uint64_t table = root;
+        for (int level = 0; level < Layout::levels; level++) {
+            auto& pte = entries[table + Layout::index(va, level) *
+                                            Layout::pte_bytes];
+            if (huge && level == Layout::levels - 2 &&
+                !Layout::table_format::valid(pte)) {
+                if constexpr (Layout::levels > 1) {
+                    pte = Layout::table_format::make_huge(allocate_huge());
+                    huge_pages++;
+                }
+                return;
+            }
+            if (level < Layout::levels - 1 &&
+                Layout::table_format::huge(pte)) {
+                return;
+            }
+            if (level == Layout::levels - 1) {
+                if (!Layout::leaf_format::valid(pte)) {
+                    pte = Layout::leaf_format::make(allocate_page());
+                    pages++;
+                }
+                return;
+            }
+            if (!Layout::table_format::valid(pte)) {
+                pte = Layout::table_format::make(allocate_table(level + 1));
+            }
+            table = Layout::table_format::address(pte);
+        }
+    }
+
+    std::uint64_t operator[](std::uint64_t address) const {
+        const auto found = entries.find(address);
+        return found == entries.end() ? 0 : found->second;
+    }
+
+    // memory taken by the tables, whole tables at every level
+    std::uint64_t table_bytes() const {
+        std::uint64_t bytes = 0;
+        for (int level = 0; level < Layout::levels; level++) {
+            bytes += tables[level] * Layout::table_bytes(level);
+        }
+        return bytes;
+    }
+
+    // physical pages allocated so far, the unused page 0 included
+    std::uint64_t physical_pages() const { return next_page; }
+
+    std::uint64_t root = 0;
+    std::array< std::uint64_t, Layout::levels > tables = {};
+    std::uint64_t pages = 0;  // base pages
+    std::uint64_t huge_pages = 0;
+
+   private:
+    std::uint64_t allocate_huge() {
+        constexpr std::uint64_t span = 1ULL
+                                       << (Layout::huge_bits -
+                                           Layout::offset_bits);
+        next_page = (next_page + span - 1) / span * span;
+        const std::uint64_t address = allocate_page();
+        next_page += span - 1;
+        return address;
+    }
+
+    std::uint64_t allocate_table(int level) {
+        tables[level]++;
+        return allocate_page();
+    }
+
+    std::uint64_t allocate_page() {
+        constexpr int frame_bits = Layout::pa_bits - Layout::offset_bits;
+        if (next_page > mask(frame_bits)) {
+            throw std::length_error("physical address space exhausted");
+        }
+        return next_page++ << Layout::offset_bits;
+    }
+
+    std::unordered_map< std::uint64_t, std::uint64_t > entries;
+    std::uint64_t next_page = 1;  // physical page 0 stays unused
+};
+
+}  // namespace layout
+
+#endif
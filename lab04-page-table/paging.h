@@ -0,0 +1,374 @@
+/* Demand paging
+
+With demand paging a walk that stops at an invalid PTE is a page fault
+instead of a failed translation. The handler maps the page and the access
+is translated again:
+- a missing table on the path (an invalid outer PTE in the lab layout) gets
+  a frame of its own, cleared, and the PTE above points to it; table
+  frames are never evicted
+- the page gets a frame from the free list, or the replacement policy
+  evicts a resident page: its PTE is cleared, and a dirty page is written
+  back to the backing store
+- the page's contents come from the backing store, or are zero for a page
+  never seen before
+
+Memory is read and written in PTE-sized words, operator[](address) and
+write(address, word).
+
+Frames at startup: every frame overlapped by a table reachable from the
+root is a table frame, every other frame a valid last-level PTE points to
+holds a resident page, the rest are free. A PTE pointing into a table
+frame, or into a frame an earlier PTE points to already, is invalidated and
+its page starts out in the backing store with the frame's contents, so
+replacement never overwrites a table or a page through a stale mapping.
+Frames under a huge page (layout.h) are pinned like table frames: huge
+pages never fault and are never evicted. `frames` limits the frames
+available to pages (resident and free, lowest addresses first); resident
+pages beyond it are saved to the backing store and unmapped before the
+run. Tables created by faults take their frames from the same pool, and
+the clock hand only ever stops at resident pages of the pool.
+
+Replacement policies, over the resident pages:
+- clock           a hand sweeps the frames in address order, clearing
+                  reference bits, and takes the first unreferenced one
+- second-chance   FIFO in load order, a referenced page has its bit cleared
+                  and goes to the back of the queue once
+- lru             the page referenced longest ago
+- working-set     at every fault, all pages outside the working set (not
+                  referenced within the last `window` references) are
+                  evicted to the free list, so the resident set follows the
+                  working set; if every page is in it, the LRU page goes
+*/
+
+#ifndef PAGING_H_
+#define PAGING_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "layout.h"
+
+namespace paging {
+
+enum class policy { clock, second_chance, lru, working_set };
+
+inline policy parse_policy(const std::string& name) {
+    if (name == "clock") return policy::clock;
+    if (name == "second-chance") return policy::second_chance;
+    if (name == "lru") return policy::lru;
+    if (name == "working-set") return policy::working_set;
+    throw std::invalid_argument("unknown page replacement policy: " + name);
+}
+
+struct Params {
+    policy replacement = policy::clock;
+    int frames = 0;  // for pages, 0: every frame not holding a table
+    std::uint64_t window = 1000;  // working-set window, in references
+};
+
+struct Stats {
+    std::uint64_t references = 0;
+    std::uint64_t faults = 0;
+    std::uint64_t table_faults = 0;  // a table on the path was missing too
+    std::uint64_t evictions = 0;
+    std::uint64_t dirty_writebacks = 0;
+};
+
+template < typename Layout, typename Memory >
+class Pager {
+   public:
+    Pager(Memory& memory_, std::uint64_t root, const Params& params_)
+        : memory(memory_),
+          params(params_),
+          frames((1ULL << Layout::pa_bits) / Layout::page_size) {
+        mark_tables(root, 0, 0);
+        // only now that every table frame is known
+        for (const auto& leaf : leaves) {
+            auto& frame = frames[leaf.frame];
+            if (frame.table || frame.page) {
+                // a table frame, or a frame mapped twice, which keeps its
+                // first owner: the page faults in a copy of the frame
+                if (backing.count(leaf.vpn) == 0) {
+                    save(leaf.frame, leaf.vpn);
+                }
+                memory.write(leaf.pte, 0);
+                continue;
+            }
+            frame.page = true;
+            frame.vpn = leaf.vpn;
+            frame.pte = leaf.pte;
+        }
+        leaves.clear();
+        std::vector< std::size_t > page_frames;
+        for (std::size_t f = 0; f < frames.size(); f++) {
+            if (!frames[f].table) {
+                page_frames.push_back(f);
+            }
+        }
+        if (params.frames > 0 &&
+            page_frames.size() > static_cast< std::size_t >(params.frames)) {
+            for (auto f = page_frames.begin() + params.frames;
+                 f != page_frames.end(); f++) {
+                if (frames[*f].page) {
+                    save(*f);
+                    unmap(*f);
+                }
+            }
+            page_frames.resize(params.frames);
+        }
+        for (const auto f : page_frames) {
+            frames[f].pooled = true;
+            if (frames[f].page) {
+                load_order.push_back(f);
+            } else {
+                free_frames.push_back(f);
+            }
+        }
+    }
+
+    // a translated access to the page in `frame`
+    void reference(std::uint64_t page_address, bool is_write) {
+        auto& frame = frames[page_address / Layout::page_size];
+        stats.references++;
+        frame.referenced = true;
+        frame.dirty |= is_write;
+        frame.last_use = stats.references;
+    }
+
+    // the walk of `va` stopped after w.valid_levels valid PTEs, at w.table;
+    // returns the virtual page numbers of the evicted pages, whose
+    // translations the caller must drop from its TLB
+    std::vector< std::uint64_t > fault(std::uint64_t va,
+                                       const layout::Walk& w) {
+        stats.faults++;
+        evicted.clear();
+        if (params.replacement == policy::working_set) {
+            trim_working_set();
+        }
+        std::uint64_t table = w.table;
+        for (int level = w.valid_levels; level < Layout::levels - 1; level++) {
+            stats.table_faults += level == w.valid_levels;
+            const std::size_t f = take_frame();
+            frames[f].table = true;
+            const std::uint64_t address = f * Layout::page_size;
+            for (std::size_t i = 0; i < words_per_page; i++) {
+                memory.write(address + i * Layout::pte_bytes, 0);
+            }
+            memory.write(pte_address(table, va, level),
+                         Layout::table_format::make(address));
+            table = address;
+        }
+
+        const std::size_t f = take_frame();
+        const std::uint64_t vpn = va >> Layout::offset_bits;
+        const std::uint64_t address = f * Layout::page_size;
+        const auto stored = backing.find(vpn);
+        for (std::size_t i = 0; i < words_per_page; i++) {
+            memory.write(address + i * Layout::pte_bytes,
+                         stored == backing.end() ? 0 : stored->second[i]);
+        }
+        const std::uint64_t pte = pte_address(table, va, Layout::levels - 1);
+        memory.write(pte, Layout::leaf_format::make(address));
+        auto& frame = frames[f];
+        frame.page = true;
+        frame.vpn = vpn;
+        frame.pte = pte;
+        frame.dirty = false;
+        frame.referenced = false;
+        load_order.push_back(f);
+        return evicted;
+    }
+
+    void report(std::ostream& out) const {
+        const auto ratio = [](double a, double b) { return b > 0 ? a / b : 0; };
+        out << "demand paging: " << stats.faults << " page faults in "
+            << stats.references << " references, fault rate "
+            << ratio(stats.faults, stats.references) << ", "
+            << stats.table_faults << " also missing a table\n";
+        out << "  " << stats.evictions << " evictions, "
+            << stats.dirty_writebacks << " dirty writebacks, "
+            << load_order.size() << " resident pages\n";
+    }
+
+    Stats stats;
+
+   private:
+    static constexpr std::size_t words_per_page =
+        Layout::page_size / Layout::pte_bytes;
+
+    struct Frame {
+        bool table = false;
+        bool pooled = false;  // available to pages
+        bool page = false;
+        bool referenced = false;
+        bool dirty = false;
+        std::uint64_t vpn = 0;
+        std::uint64_t pte = 0;  // address of the PTE mapping it
+        std::uint64_t last_use = 0;
+    };
+
+    static std::uint64_t pte_address(std::uint64_t table, std::uint64_t va,
+                                     int level) {
+        return table + Layout::index(va, level) * Layout::pte_bytes;
+    }
+
+    void mark_tables(std::uint64_t table, int level, std::uint64_t prefix) {
+        const auto first = table / Layout::page_size;
+        const auto last =
+            (table + Layout::table_bytes(level) - 1) / Layout::page_size;
+        for (auto f = first; f <= last && f < frames.size(); f++) {
+            frames[f].table = true;
+        }
+        const bool leaf = level == Layout::levels - 1;
+        for (std::uint64_t i = 0; i < (1ULL << Layout::level_bits[level]);
+             i++) {
+            const std::uint64_t pte = memory[table + i * Layout::pte_bytes];
+            const std::uint64_t index = prefix << Layout::level_bits[level] | i;
+            if (!leaf && Layout::table_format::valid(pte) &&
+                Layout::table_format::huge(pte)) {
+                const auto first = Layout::table_format::address(pte) /
+                                   Layout::page_size;
+                const auto span = 1ULL << (Layout::shift(level) -
+                                           Layout::offset_bits);
+                for (auto f = first; f < first + span && f < frames.size();
+                     f++) {
+                    frames[f].table = true;
+                }
+            } else if (!leaf && Layout::table_format::valid(pte)) {
+                mark_tables(Layout::table_format::address(pte), level + 1,
+                            index);
+            } else if (leaf && Layout::leaf_format::valid(pte)) {
+                const auto f =
+                    Layout::leaf_format::address(pte) / Layout::page_size;
+                if (f < frames.size()) {
+                    leaves.push_back({f, index, table + i * Layout::pte_bytes});
+                }
+            }
+        }
+    }
+
+    std::size_t take_frame() {
+        if (!free_frames.empty()) {
+            const auto f = free_frames.front();
+            free_frames.pop_front();
+            return f;
+        }
+        if (load_order.empty()) {
+            throw std::runtime_error("out of frames, every frame is a table");
+        }
+        const std::size_t f = victim();
+        evict(f);
+        return f;
+    }
+
+    void trim_working_set() {
+        std::vector< std::size_t > outside;
+        for (const auto f : load_order) {
+            if (stats.references - frames[f].last_use >= params.window) {
+                outside.push_back(f);
+            }
+        }
+        for (const auto f : outside) {
+            evict(f);
+            free_frames.push_back(f);
+        }
+    }
+
+    void evict(std::size_t f) {
+        const auto loaded = std::find(load_order.begin(), load_order.end(), f);
+        if (loaded == load_order.end()) {
+            throw std::logic_error("evicting a frame that holds no page");
+        }
+        load_order.erase(loaded);
+        stats.evictions++;
+        auto& frame = frames[f];
+        if (frame.dirty || backing.count(frame.vpn) == 0) {
+            stats.dirty_writebacks += frame.dirty;
+            save(f);
+        }
+        evicted.push_back(frame.vpn);
+        unmap(f);
+    }
+
+    // the contents of frame `f` to the backing store, as page `vpn`
+    void save(std::size_t f) { save(f, frames[f].vpn); }
+
+    void save(std::size_t f, std::uint64_t vpn) {
+        auto& stored = backing[vpn];
+        stored.resize(words_per_page);
+        for (std::size_t i = 0; i < words_per_page; i++) {
+            stored[i] = memory[f * Layout::page_size + i * Layout::pte_bytes];
+        }
+    }
+
+    void unmap(std::size_t f) {
+        memory.write(frames[f].pte, 0);
+        frames[f].page = false;
+    }
+
+    std::size_t victim() {
+        switch (params.replacement) {
+            case policy::clock:
+                for (;;) {
+                    hand = (hand + 1) % frames.size();
+                    auto& frame = frames[hand];
+                    if (!frame.pooled || !frame.page) {
+                        continue;
+                    }
+                    if (!frame.referenced) {
+                        return hand;
+                    }
+                    frame.referenced = false;
+                }
+            case policy::second_chance:
+                for (;;) {
+                    const auto f = load_order.front();
+                    if (!frames[f].referenced) {
+                        return f;
+                    }
+                    frames[f].referenced = false;
+                    load_order.pop_front();
+                    load_order.push_back(f);
+                }
+            case policy::lru:
+            case policy::working_set:
+                break;
+        }
+        return least_recent();
+    }
+
+    std::size_t least_recent() const {
+        return *std::min_element(load_order.begin(), load_order.end(),
+                                 [&](std::size_t a, std::size_t b) {
+                                     return frames[a].last_use <
+                                            frames[b].last_use;
+                                 });
+    }
+
+    Memory& memory;
+    Params params;
+    std::vector< Frame > frames;
+    std::deque< std::size_t > free_frames;
+    std::deque< std::size_t > load_order;  // resident pages
+    // page contents by virtual page number, in PTE-sized words
+    std::unordered_map< std::uint64_t, std::vector< std::uint64_t > > backing;
+    std::size_t hand = 0;
+    std::vector< std::uint64_t > evicted;  // by the current fault
+
+    struct Leaf {
+        std::size_t frame;
+        std::uint64_t vpn;
+        std::uint64_t pte;
+    };
+    std::vector< Leaf > leaves;  // valid last-level PTEs, while marking
+};
+
+}  // namespace paging
+
+#endif
@@ -0,0 +1,243 @@
+/* Translation lookaside buffers
+
+A TLB caches VPN -> frame translations of valid pages, so only its misses
+walk the page table in PhysicalMemory. Invalid translations are never
+cached, every request for them walks again.
+
+Organization:
+- `entries` translations in sets of `ways`, the set is VPN % sets
+- replacement per set by one of the cache simulator's policies
+  (../lab03-cache-simulator/replacement.h), chosen at compile time
+- an optional second level (l2_entries > 0), looked up after an L1 miss;
+  a walk fills both levels, an L2 hit fills L1
+- optional huge-page entries (huge_entries > 0), looked up next to L1 and
+  keyed by the virtual address above `huge_bits`; a walk that found a huge
+  page fills them with the page's base, larger pages splintered to
+  `huge_bits`, or fills the base-page levels when there are none
+
+TLB reach, the memory the entries map at once, is reported as configured
+(every entry valid) and as held at the end of the run.
+
+Level is a plain set-associative key -> value store and also serves as the
+page-walk cache of outer PTEs.
+*/
+
+#ifndef TLB_H_
+#define TLB_H_
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../lab03-cache-simulator/replacement.h"
+
+namespace tlb {
+
+struct Params {
+    int entries = 0;  // 0: no TLB, every request walks
+    int ways = 4;
+    std::string policy = replacement::Lru::name;
+    int l2_entries = 0;
+    int l2_ways = 8;
+    int huge_entries = 0;
+    int huge_ways = 4;
+};
+
+struct Stats {
+    std::uint64_t lookups = 0;
+    std::uint64_t l1_hits = 0;
+    std::uint64_t l2_hits = 0;
+    std::uint64_t huge_hits = 0;
+    std::uint64_t misses = 0;
+};
+
+template < typename Policy >
+class Level {
+   public:
+    Level(int entries, int ways_) : ways(ways_) {
+        if (ways < 1 || entries < ways || entries % ways != 0) {
+            throw std::invalid_argument(
+                "TLB entries must be a multiple of its associativity");
+        }
+        n_sets = entries / ways;
+        slots.resize(entries);
+        policies.assign(n_sets, Policy(ways));
+    }
+
+    bool lookup(std::uint64_t vpn, std::uint64_t& frame) {
+        const unsigned set = vpn % n_sets;
+        for (int way = 0; way < ways; way++) {
+            const auto& slot = slots[set * ways + way];
+            if (slot.valid && slot.vpn == vpn) {
+                policies[set].on_hit(way);
+                frame = slot.frame;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void insert(std::uint64_t vpn, std::uint64_t frame) {
+        const unsigned set = vpn % n_sets;
+        int way = 0;
+        while (way < ways && slots[set * ways + way].valid) {
+            way++;
+        }
+        if (way == ways) {
+            way = policies[set].victim();
+        }
+        slots[set * ways + way] = {true, vpn, frame};
+        policies[set].on_fill(way);
+    }
+
+    void invalidate(std::uint64_t vpn) {
+        const unsigned set = vpn % n_sets;
+        for (int way = 0; way < ways; way++) {
+            auto& slot = slots[set * ways + way];
+            if (slot.valid && slot.vpn == vpn) {
+                slot.valid = false;
+            }
+        }
+    }
+
+    std::size_t entries() const { return slots.size(); }
+
+    std::size_t valid_entries() const {
+        std::size_t n = 0;
+        for (const auto& slot : slots) {
+            n += slot.valid;
+        }
+        return n;
+    }
+
+   private:
+    struct Slot {
+        bool valid = false;
+        std::uint64_t vpn = 0;
+        std::uint64_t frame = 0;
+    };
+
+    int ways;
+    unsigned n_sets;
+    std::vector< Slot > slots;  // set-major
+    std::vector< Policy > policies;
+};
+
+template < typename Policy >
+class Tlb {
+   public:
+    // base pages have `offset_bits_` offset bits, huge ones `huge_bits_`
+    Tlb(const Params& params, int offset_bits_, int huge_bits_)
+        : offset_bits(offset_bits_),
+          huge_bits(huge_bits_),
+          l1(params.entries, params.ways) {
+        if (params.l2_entries > 0) {
+            l2.emplace(params.l2_entries, params.l2_ways);
+        }
+        if (params.huge_entries > 0) {
+            huge.emplace(params.huge_entries, params.huge_ways);
+        }
+    }
+
+    // the base page's address for `va`
+    bool lookup(std::uint64_t va, std::uint64_t& page) {
+        stats.lookups++;
+        const std::uint64_t vpn = va >> offset_bits;
+        if (l1.lookup(vpn, page)) {
+            stats.l1_hits++;
+            return true;
+        }
+        if (huge && huge->lookup(va >> huge_bits, page)) {
+            stats.huge_hits++;
+            page |= va & mask(huge_bits) & ~mask(offset_bits);
+            return true;
+        }
+        if (l2 && l2->lookup(vpn, page)) {
+            stats.l2_hits++;
+            l1.insert(vpn, page);
+            return true;
+        }
+        stats.misses++;
+        return false;
+    }
+
+    // a walk found a valid translation, to a page with `page_bits` offset
+    // bits
+    void insert(std::uint64_t va, std::uint64_t page, int page_bits) {
+        if (huge && page_bits >= huge_bits) {
+            huge->insert(va >> huge_bits, page & ~mask(huge_bits));
+            return;
+        }
+        const std::uint64_t vpn = va >> offset_bits;
+        l1.insert(vpn, page);
+        if (l2) {
+            l2->insert(vpn, page);
+        }
+    }
+
+    // the translation changed, e.g. the page was evicted
+    void invalidate(std::uint64_t vpn) {
+        l1.invalidate(vpn);
+        if (l2) {
+            l2->invalidate(vpn);
+        }
+        if (huge) {
+            huge->invalidate(vpn >> (huge_bits - offset_bits));
+        }
+    }
+
+    void report(std::ostream& out) const {
+        const auto ratio = [](double a, double b) { return b > 0 ? a / b : 0; };
+        const auto hits = stats.l1_hits + stats.l2_hits + stats.huge_hits;
+        out << "TLB: " << stats.lookups << " lookups, hit rate "
+            << ratio(hits, stats.lookups) << " (L1 " << stats.l1_hits;
+        if (l2) {
+            out << ", L2 " << stats.l2_hits;
+        }
+        if (huge) {
+            out << ", huge " << stats.huge_hits;
+        }
+        out << "), " << stats.misses << " misses\n";
+
+        const auto reach = [&](bool held) {
+            const auto bytes = [&](const auto& level, int bits) {
+                return (held ? level.valid_entries() : level.entries())
+                       << bits;
+            };
+            std::uint64_t l1_bytes = bytes(l1, offset_bits);
+            if (huge) {
+                l1_bytes += bytes(*huge, huge_bits);
+            }
+            return std::make_pair(l1_bytes, l2 ? bytes(*l2, offset_bits) : 0);
+        };
+        const auto [l1_reach, l2_reach] = reach(false);
+        const auto [l1_held, l2_held] = reach(true);
+        out << "TLB reach: L1 " << l1_reach << " bytes (" << l1_held
+            << " held)";
+        if (l2) {
+            out << ", L2 " << l2_reach << " bytes (" << l2_held << " held)";
+        }
+        out << '\n';
+    }
+
+    Stats stats;
+
+   private:
+    static constexpr std::uint64_t mask(int bits) {
+        return (1ULL << bits) - 1;
+    }
+
+    int offset_bits;
+    int huge_bits;
+    Level< Policy > l1;
+    std::optional< Level< Policy > > l2;
+    std::optional< Level< Policy > > huge;
+};
+
+}  // namespace tlb
+
+#endif
@@ -0,0 +1,224 @@
+/* Virtual memory for the MIPS cores
+
+Translates every instruction fetch, load and store of the lab01/lab02
+simulators through a radix page table, so whole programs run in a virtual
+address space:
+- 32-bit virtual addresses, 256-byte pages, three levels of 8 index bits
+- 16-bit physical addresses; a page's frame is read from IMem for fetches
+  and from DMem for loads and stores, the same mapping for both
+- the tables live in their own memory image, "ptmem.txt" (one byte per
+  line, in binary, like imem.txt), out of the program's reach; the PTBR
+  register points to the root table in it
+- PTEs are 4 bytes, valid bit 0; an intermediate PTE holds the next table's
+  address in bits 16 and up, a last-level PTE the frame number in bits 24
+  and up, as in the lab's page table
+- an optional TLB (tlb.h, LRU) in front of the walk
+
+A walk that ends at an invalid PTE, or a page beyond the core's physical
+memory, is a page fault: translate() throws PageFault and the core stops.
+
+Enabled from the environment, like MEMTRACE:
+    PTBR=<file>              the PTBR in binary, e.g. "0000010000000000"
+    PTMEM=<file>             the table image (default: ptmem.txt)
+    TLB=<N>                  N-entry TLB
+    TLB_WAYS=<N>             its associativity (default 4)
+    WALK_LATENCY=<cycles>    per PTE read, charged by the pipelined core as
+                             stall cycles (default 10), each dumped as a
+                             "stall:" marker instead of a repeated state
+*/
+
+#ifndef VM_H_
+#define VM_H_
+
+#include <bitset>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "layout.h"
+#include "tlb.h"
+
+namespace vm {
+
+using Layout = layout::Layout< 16, 4, layout::PteFormat< 16, 16, 0 >,
+                               layout::PteFormat< 24, 8, 8 >, 8, 8, 8, 8 >;
+
+enum class access { fetch, load, store };
+
+inline const char* name(access a) {
+    switch (a) {
+        case access::fetch:
+            return "fetch";
+        case access::load:
+            return "load";
+        case access::store:
+            return "store";
+    }
+    return "";
+}
+
+class PageFault : public std::runtime_error {
+   public:
+    PageFault(unsigned va_, access type_)
+        : std::runtime_error(message(va_, type_)), va(va_), type(type_) {}
+
+    unsigned va;
+    access type;
+
+   private:
+    static std::string message(unsigned va, access type) {
+        std::ostringstream out;
+        out << "page fault on " << name(type) << " at 0x" << std::hex << va;
+        return out.str();
+    }
+};
+
+struct Config {
+    std::string ptbr_file;
+    std::string ptmem_file = "ptmem.txt";
+    tlb::Params tlb;
+    unsigned walk_latency = 10;
+
+    // nothing without PTBR
+    static std::optional< Config > from_env() {
+        const char* ptbr = std::getenv("PTBR");
+        if (ptbr == nullptr) {
+            return std::nullopt;
+        }
+        Config config;
+        config.ptbr_file = ptbr;
+        if (const char* ptmem = std::getenv("PTMEM")) {
+            config.ptmem_file = ptmem;
+        }
+        if (const char* entries = std::getenv("TLB")) {
+            config.tlb.entries = std::stoi(entries);
+        }
+        if (const char* ways = std::getenv("TLB_WAYS")) {
+            config.tlb.ways = std::stoi(ways);
+        }
+        if (const char* latency = std::getenv("WALK_LATENCY")) {
+            config.walk_latency = std::stoul(latency);
+        }
+        return config;
+    }
+};
+
+class TableMemory {
+    /*
+     * the page-table image, read in big-endian PTE-sized words
+     */
+   public:
+    explicit TableMemory(const std::string& filename)
+        : bytes(1 << Layout::pa_bits) {
+        std::ifstream in(filename);
+        if (!in.is_open()) {
+            throw std::runtime_error("cannot open " + filename);
+        }
+        std::string line;
+        for (std::size_t i = 0; i < bytes.size() && getline(in, line); i++) {
+            bytes[i] = std::bitset< 8 >(line).to_ulong();
+        }
+    }
+
+    std::uint64_t operator[](std::uint64_t address) const {
+        std::uint64_t word = 0;
+        for (int i = 0; i < Layout::pte_bytes; i++) {
+            word = word << 8 | bytes.at(address + i);
+        }
+        return word;
+    }
+
+   private:
+    std::vector< std::uint8_t > bytes;
+};
+
+struct Stats {
+    std::uint64_t translations[3] = {};  // by access type
+    std::uint64_t walks = 0;
+    std::uint64_t table_reads = 0;
+};
+
+class Mmu {
+   public:
+    // physical_bytes: the size of the core's IMem and DMem
+    Mmu(const Config& config, std::size_t physical_bytes_)
+        : memory(config.ptmem_file),
+          walker(memory, read_ptbr(config.ptbr_file)),
+          physical_bytes(physical_bytes_),
+          walk_latency(config.walk_latency) {
+        if (config.tlb.entries > 0) {
+            tlb.emplace(config.tlb, Layout::offset_bits, Layout::huge_bits);
+        }
+    }
+
+    // the physical address of the word at `va`
+    unsigned translate(unsigned va, access type) {
+        stats.translations[static_cast< int >(type)]++;
+        std::uint64_t page;
+        if (!tlb || !tlb->lookup(va, page)) {
+            const auto w = walker.walk(va);
+            stats.walks++;
+            stats.table_reads += w.reads;
+            pending_reads += w.reads;
+            if (w.valid_levels < Layout::levels) {
+                throw PageFault(va, type);
+            }
+            page = w.address;
+            if (tlb) {
+                tlb->insert(va, page, w.page_bits);
+            }
+        }
+        const std::uint64_t address =
+            page | (va & layout::mask(Layout::offset_bits));
+        if (address + 4 > physical_bytes) {
+            throw PageFault(va, type);
+        }
+        return address;
+    }
+
+    // cycles spent walking since the last call
+    unsigned take_walk_cycles() {
+        const unsigned cycles = pending_reads * walk_latency;
+        pending_reads = 0;
+        return cycles;
+    }
+
+    void report(std::ostream& out) const {
+        out << "virtual memory: " << stats.translations[0] << " fetches, "
+            << stats.translations[1] << " loads, " << stats.translations[2]
+            << " stores translated, " << stats.walks << " page walks, "
+            << stats.table_reads << " page-table reads\n";
+        if (tlb) {
+            tlb->report(out);
+        }
+    }
+
+    Stats stats;
+
+   private:
+    static std::uint64_t read_ptbr(const std::string& filename) {
+        std::ifstream in(filename);
+        std::bitset< Layout::pa_bits > ptbr;
+        if (!(in >> ptbr)) {
+            throw std::runtime_error("cannot read the PTBR from " + filename);
+        }
+        return ptbr.to_ulong();
+    }
+
+    TableMemory memory;
+    layout::Walker< Layout, TableMemory > walker;
+    std::optional< tlb::Tlb< replacement::Lru > > tlb;
+    std::size_t physical_bytes;
+    unsigned walk_latency;
+    unsigned pending_reads = 0;
+};
+
+}  // namespace vm
+
+#endif